@@ -201,6 +201,12 @@ let check_arm_header verbose =
     end
   end
 
+let check_ocaml_version () =
+  let found = Scanf.sscanf Sys.ocaml_version "%d.%d"
+    (fun major minor -> (major, minor) >= (4, 10)) in
+  Printf.printf "Looking for OCaml 4.10 or later: %s\n" (if found then "ok" else "missing");
+  found
+
 let disable_xenguest =
   let doc = "Don't build any xenguest binary" in
   Arg.(value & flag & info ["disable-xenguest"] ~docv:"DISABLE_XENGUEST" ~doc)
@@ -233,6 +239,10 @@ let configure verbose disable_xenguest =
   let domain_create_has_config = xen_4_7 in
   let xc_domain_save_generation_id = find_xc_domain_save_generation_id verbose in
   let have_viridian = find_define verbose "HVM_PARAM_VIRIDIAN" in
+  if not (check_ocaml_version ()) then begin
+    Printf.fprintf stderr "Failure: Xenmmap views need OCaml 4.10 or later\n";
+    exit 1;
+  end;
   if not xenctrl then begin
     Printf.fprintf stderr "Failure: we can't build anything without xenctrl.h\n";
     exit 1;
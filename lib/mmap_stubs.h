@@ -23,11 +23,24 @@
 #include <caml/custom.h>
 #include <caml/fail.h>
 #include <caml/callback.h>
+#include <caml/bigarray.h>
+#include <stddef.h>
 
 struct mmap_interface
 {
 	void *addr;
-	int len;
+	size_t len;
+	/* Shared with the bigarray views of the mapping, once there are any */
+	struct caml_ba_proxy *proxy;
 };
 
+#define Intf_val(a) ((struct mmap_interface *) Data_custom_val(a))
+
+/* Allocate the GC-managed block of a mapping of len bytes, which unmaps
+ * it when collected unless it was explicitly unmapped before. It is made
+ * before the mapping, so that nothing can raise between mapping and
+ * wrapping: store the address in Intf_val(v)->addr once mapped. Until
+ * then the block owns nothing. */
+value alloc_mmap_interface(size_t len);
+
 #endif
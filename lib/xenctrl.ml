@@ -48,6 +48,31 @@ type domaininfo =
 	handle            : int array;
 }
 
+type domain_change =
+	| Domain_created of domaininfo
+	| Domain_destroyed of domid
+	| Domain_changed of domaininfo
+
+type domain_tracker
+
+type int32_column = (int32, Bigarray.int32_elt, Bigarray.c_layout) Bigarray.Array1.t
+type int64_column = (int64, Bigarray.int64_elt, Bigarray.c_layout) Bigarray.Array1.t
+
+type domaininfo_snapshot =
+{
+	snap_domid             : int32_column;
+	snap_flags             : int32_column;
+	snap_tot_pages         : int64_column;
+	snap_max_pages         : int64_column;
+	snap_shared_info_frame : int64_column;
+	snap_cpu_time          : int64_column;
+	snap_nr_online_vcpus   : int32_column;
+	snap_max_vcpu_id       : int32_column;
+	snap_ssidref           : int32_column;
+	snap_handle            : (int, Bigarray.int8_unsigned_elt, Bigarray.c_layout) Bigarray.Array2.t;
+	snap_raw               : (char, Bigarray.int8_unsigned_elt, Bigarray.c_layout) Bigarray.Array1.t;
+}
+
 type runstateinfo = {
 	state : int32;
 	missed_changes: int32;
@@ -120,17 +145,43 @@ let with_intf f =
 	interface_close xc;
 	r
 
+external handle_buffer_grows: handle -> int = "stub_xc_handle_buffer_grows"
+
+type handle_pool
+
+external handle_pool_create: int -> handle_pool = "stub_xc_handle_pool_create"
+external handle_pool_checkout: handle_pool -> handle = "stub_xc_handle_pool_checkout"
+external handle_pool_return: handle_pool -> handle -> unit = "stub_xc_handle_pool_return"
+
+let with_pool_intf pool f =
+	let xc = handle_pool_checkout pool in
+	let r = try f xc with exn -> handle_pool_return pool xc; raise exn in
+	handle_pool_return pool xc;
+	r
+
 external _domain_create: handle -> int32 -> domain_create_flag list -> int array -> domid
        = "stub_xc_domain_create"
 
+type uuid = string
+
+external uuid_of_string: string -> uuid = "stub_xc_uuid_of_string"
+external uuid_to_string: uuid -> string = "stub_xc_uuid_to_string"
+
+let uuid_of_bytes s =
+	if String.length s <> 16 then invalid_arg "uuid_of_bytes";
+	s
+
+let uuid_to_bytes u = u
+
+let uuid_of_handle h =
+	if Array.length h <> 16 then invalid_arg "uuid_of_handle";
+	String.init 16 (fun i -> Char.unsafe_chr (h.(i) land 0xff))
+
+let handle_of_uuid u = Array.init 16 (fun i -> Char.code u.[i])
+
 let int_array_of_uuid_string s =
-	try
-		Scanf.sscanf s
-			"%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x"
-			(fun a0 a1 a2 a3 a4 a5 a6 a7 a8 a9 a10 a11 a12 a13 a14 a15 ->
-				[| a0; a1; a2; a3; a4; a5; a6; a7;
-				   a8; a9; a10; a11; a12; a13; a14; a15 |])
-	with _ -> invalid_arg ("Xc.int_array_of_uuid_string: " ^ s)
+	try handle_of_uuid (uuid_of_string s)
+	with Invalid_argument _ -> invalid_arg ("Xc.int_array_of_uuid_string: " ^ s)
 
 let domain_create handle n flags uuid =
 	_domain_create handle n flags (int_array_of_uuid_string uuid)
@@ -152,22 +203,192 @@ external domain_destroy: handle -> domid -> unit = "stub_xc_domain_destroy"
 external domain_shutdown: handle -> domid -> shutdown_reason -> unit
        = "stub_xc_domain_shutdown"
 
-external _domain_getinfolist: handle -> domid -> int -> domaininfo list
+external _domain_batch_op: handle -> int -> shutdown_reason -> domid array -> int -> int array
+       = "stub_xc_domain_batch_op"
+
+let domain_pause_many handle domids =
+	_domain_batch_op handle 0 Poweroff domids 1
+let domain_unpause_many handle domids =
+	_domain_batch_op handle 1 Poweroff domids 1
+let domain_destroy_many ?(workers = 1) handle domids =
+	_domain_batch_op handle 2 Poweroff domids workers
+let domain_shutdown_many handle domids reason =
+	_domain_batch_op handle 3 reason domids 1
+
+external domain_getinfolist_array: handle -> domid -> domaininfo array
        = "stub_xc_domain_getinfolist"
 
 let domain_getinfolist handle first_domain =
-	let nb = 2 in
-	let last_domid l = (List.hd l).domid + 1 in
-	let rec __getlist from =
-		let l = _domain_getinfolist handle from nb in
-		(if List.length l = nb then __getlist (last_domid l) else []) @ l
-		in
-	List.rev (__getlist first_domain)
+	Array.to_list (domain_getinfolist_array handle first_domain)
 
 external domain_getinfo: handle -> domid -> domaininfo = "stub_xc_domain_getinfo"
 
+type call_error =
+{
+	errno   : int;
+	xc_code : int;
+}
+
+external call_error_message: call_error -> string = "stub_xc_call_error_message"
+
+let raise_call_error e = raise (Error (call_error_message e))
+
+external domain_exists: handle -> domid -> bool = "stub_xc_domain_exists"
+external domain_getinfo_result: handle -> domid -> (domaininfo, call_error) result
+       = "stub_xc_domain_getinfo_result"
+external domain_getinfolist_result: handle -> domid -> (domaininfo array, call_error) result
+       = "stub_xc_domain_getinfolist_result"
+
+external domain_tracker_create: unit -> domain_tracker
+       = "stub_xc_domain_tracker_create"
+external domain_getinfo_changes: handle -> domain_tracker -> int * domain_change list
+       = "stub_xc_domain_getinfo_changes"
+
+type virq_watch
+
+external virq_dom_exc_bind: unit -> virq_watch = "stub_xc_virq_dom_exc_bind"
+external virq_fd: virq_watch -> Unix.file_descr = "stub_xc_virq_fd"
+external virq_drain: virq_watch -> bool = "stub_xc_virq_drain"
+external virq_close: virq_watch -> unit = "stub_xc_virq_close"
+
+type domain_watcher =
+{
+	dw_virq               : virq_watch option; (* None when polling *)
+	dw_tracker            : domain_tracker;
+	mutable dw_primed     : bool;
+	mutable dw_generation : int;
+	mutable dw_listeners  : (domain_change list -> unit) list;
+}
+
+let domain_watcher_create () =
+	{
+		dw_virq = (try Some (virq_dom_exc_bind ()) with Failure _ -> None);
+		dw_tracker = domain_tracker_create ();
+		dw_primed = false;
+		dw_generation = 0;
+		dw_listeners = [];
+	}
+
+let domain_watcher_on_changes w f = w.dw_listeners <- w.dw_listeners @ [ f ]
+
+let domain_watcher_fd w =
+	match w.dw_virq with
+	| Some virq -> Some (virq_fd virq)
+	| None -> None
+
+let domain_watcher_changes handle w =
+	(* Acknowledge the virq before reading the domain list, so that any
+	   later event wakes the fd up again *)
+	let fired = match w.dw_virq with
+		| Some virq -> virq_drain virq
+		| None -> true in
+	if fired || not w.dw_primed then begin
+		let (generation, changes) = domain_getinfo_changes handle w.dw_tracker in
+		w.dw_primed <- true;
+		w.dw_generation <- generation;
+		if changes <> [] then List.iter (fun f -> f changes) w.dw_listeners;
+		(generation, changes)
+	end else
+		(w.dw_generation, [])
+
+let domain_watcher_close w =
+	match w.dw_virq with
+	| Some virq -> virq_close virq
+	| None -> ()
+
+type uuid_index =
+{
+	ui_by_uuid  : (uuid, domid) Hashtbl.t;
+	ui_by_domid : (domid, uuid) Hashtbl.t;
+}
+
+let uuid_index_create () =
+	{
+		ui_by_uuid = Hashtbl.create 64;
+		ui_by_domid = Hashtbl.create 64;
+	}
+
+let uuid_index_length idx = Hashtbl.length idx.ui_by_domid
+
+let uuid_index_find idx uuid =
+	try Some (Hashtbl.find idx.ui_by_uuid uuid) with Not_found -> None
+
+let uuid_index_uuid idx domid =
+	try Some (Hashtbl.find idx.ui_by_domid domid) with Not_found -> None
+
+let uuid_index_remove idx domid =
+	match uuid_index_uuid idx domid with
+	| None -> ()
+	| Some uuid ->
+		Hashtbl.remove idx.ui_by_domid domid;
+		(* Another domain may have taken the uuid over since *)
+		if uuid_index_find idx uuid = Some domid then
+			Hashtbl.remove idx.ui_by_uuid uuid
+
+let uuid_index_add idx info =
+	let uuid = uuid_of_handle info.handle in
+	match uuid_index_uuid idx info.domid with
+	| Some old when old = uuid -> ()
+	| _ ->
+		uuid_index_remove idx info.domid;
+		Hashtbl.replace idx.ui_by_domid info.domid uuid;
+		Hashtbl.replace idx.ui_by_uuid uuid info.domid
+
+let uuid_index_apply_changes idx changes =
+	List.iter (function
+		| Domain_created info | Domain_changed info -> uuid_index_add idx info
+		| Domain_destroyed domid -> uuid_index_remove idx domid
+	) changes
+
+let uuid_index_update idx infos =
+	let seen = Hashtbl.create (Array.length infos) in
+	Array.iter (fun info ->
+		Hashtbl.replace seen info.domid ();
+		uuid_index_add idx info
+	) infos;
+	if Hashtbl.length idx.ui_by_domid > Array.length infos then begin
+		let gone = Hashtbl.fold (fun domid _ acc ->
+			if Hashtbl.mem seen domid then acc else domid :: acc
+		) idx.ui_by_domid [] in
+		List.iter (uuid_index_remove idx) gone
+	end
+
+external domaininfo_snapshot_create: int -> domaininfo_snapshot
+       = "stub_xc_domaininfo_snapshot_create"
+external domain_getinfolist_snapshot: handle -> domid -> domaininfo_snapshot -> int
+       = "stub_xc_domain_getinfolist_snapshot"
+
+let domaininfo_snapshot_capacity snap = Bigarray.Array1.dim snap.snap_domid
+
+(* XEN_DOMINF_* bits of snap_flags, from xen/include/public/domctl.h *)
+let dominf_dying     = 1 lsl 0
+let dominf_hvm_guest = 1 lsl 1
+let dominf_shutdown  = 1 lsl 2
+let dominf_paused    = 1 lsl 3
+let dominf_blocked   = 1 lsl 4
+let dominf_running   = 1 lsl 5
+
+let dominf_shutdown_code flags = (flags lsr 16) land 0xff
+
 external domain_get_vcpuinfo: handle -> domid -> int -> vcpuinfo
        = "stub_xc_vcpu_getinfo"
+external domain_get_vcpuinfo_result: handle -> domid -> int -> (vcpuinfo, call_error) result
+       = "stub_xc_vcpu_getinfo_result"
+
+type vcpuinfo_matrix = (int64, Bigarray.int64_elt, Bigarray.c_layout) Bigarray.Array2.t
+
+let vcpuinfo_col_domid    = 0
+let vcpuinfo_col_vcpu     = 1
+let vcpuinfo_col_online   = 2
+let vcpuinfo_col_blocked  = 3
+let vcpuinfo_col_running  = 4
+let vcpuinfo_col_cputime  = 5
+let vcpuinfo_col_cpu      = 6
+
+external domain_get_all_vcpuinfo: handle -> domid -> vcpuinfo_matrix
+       = "stub_xc_domain_get_all_vcpuinfo"
+external all_domains_get_vcpuinfo: handle -> vcpuinfo_matrix
+       = "stub_xc_all_domains_get_vcpuinfo"
 
 external domain_ioport_permission: handle -> domid -> int -> int -> bool -> unit
        = "stub_xc_domain_ioport_permission"
@@ -181,6 +402,130 @@ external vcpu_affinity_set: handle -> domid -> int -> bool array -> unit
 external vcpu_affinity_get: handle -> domid -> int -> bool array
        = "stub_xc_vcpu_getaffinity"
 
+type cpumap = Bytes.t
+
+external cpumap_size: handle -> int = "stub_xc_cpumap_size"
+
+let cpumap_create handle = Bytes.make (cpumap_size handle) '\000'
+
+let cpumap_mem map cpu =
+	cpu / 8 < Bytes.length map
+	&& Char.code (Bytes.get map (cpu / 8)) land (1 lsl (cpu land 7)) <> 0
+
+let cpumap_set map cpu =
+	let b = Char.code (Bytes.get map (cpu / 8)) in
+	Bytes.set map (cpu / 8) (Char.unsafe_chr (b lor (1 lsl (cpu land 7))))
+
+let cpumap_clear map cpu =
+	let b = Char.code (Bytes.get map (cpu / 8)) in
+	Bytes.set map (cpu / 8) (Char.unsafe_chr (b land lnot (1 lsl (cpu land 7))))
+
+external vcpu_affinity_set_cpumap: handle -> domid -> int -> cpumap -> unit
+       = "stub_xc_vcpu_setaffinity_cpumap"
+external vcpu_affinity_get_cpumap: handle -> domid -> int -> cpumap
+       = "stub_xc_vcpu_getaffinity_cpumap"
+external domain_set_affinity_all_vcpus: handle -> domid -> cpumap array -> unit
+       = "stub_xc_domain_set_affinity_all_vcpus"
+
+type domain_config =
+{
+	cfg_ssidref      : int32;
+	cfg_flags        : domain_create_flag list;
+	cfg_max_vcpus    : int;
+	cfg_max_memkb    : int64;
+	cfg_shadow_mb    : int option;
+	cfg_address_size : int option;
+	cfg_sched        : sched_control option;
+	cfg_affinity     : cpumap array;
+}
+
+external _domain_create_full: handle -> domain_config -> int array -> domid
+       = "stub_xc_domain_create_full"
+
+let domain_create_full handle config uuid =
+	_domain_create_full handle config (int_array_of_uuid_string uuid)
+
+type cputopo =
+{
+	core   : int;
+	socket : int;
+	node   : int;
+}
+
+type numainfo =
+{
+	node_memsize   : int64 array;
+	node_memfree   : int64 array;
+	node_distances : int array array;
+}
+
+external cputopoinfo: handle -> cputopo array = "stub_xc_cputopoinfo"
+external numainfo: handle -> numainfo = "stub_xc_numainfo"
+
+type numa_placement =
+{
+	placement_nodes  : int list;
+	placement_cpumap : cpumap;
+}
+
+(* Grows a node set from each node in turn, adding the nearest node until
+   the set has enough memory and pCPUs, and keeps the best set found:
+   fewest nodes, then shortest distance, then least loaded, then most
+   free memory *)
+let numa_place ?(node_load = [||]) numainfo topo ~vcpus ~memory =
+	let nr_nodes = Array.length numainfo.node_memfree in
+	let cpus = Array.make nr_nodes [] in
+	Array.iteri (fun cpu t ->
+		if t.node >= 0 && t.node < nr_nodes then cpus.(t.node) <- cpu :: cpus.(t.node))
+		topo;
+	let memfree n = max 0L numainfo.node_memfree.(n) in
+	let distance a b =
+		let d = numainfo.node_distances.(a).(b) in
+		if d < 0 then max_int else d in
+	let load n = if n < Array.length node_load then node_load.(n) else 0 in
+	let rec grow seed set mem ncpus =
+		if mem >= memory && ncpus >= vcpus then Some set
+		else begin
+			let next = ref (-1) in
+			for n = 0 to nr_nodes - 1 do
+				if cpus.(n) <> [] && not (List.mem n set) then begin
+					let better =
+						!next < 0
+						|| distance seed n < distance seed !next
+						|| (distance seed n = distance seed !next
+						    && memfree n > memfree !next) in
+					if better then next := n
+				end
+			done;
+			if !next < 0 then None
+			else grow seed (!next :: set) (Int64.add mem (memfree !next))
+				(ncpus + List.length cpus.(!next))
+		end in
+	let score set =
+		let span = List.fold_left (fun acc a ->
+			List.fold_left (fun acc b -> max acc (distance a b)) acc set) 0 set in
+		let ncpus = List.fold_left (fun acc n -> acc + List.length cpus.(n)) 0 set in
+		let busy = List.fold_left (fun acc n -> acc + load n) 0 set in
+		let free = List.fold_left (fun acc n -> Int64.add acc (memfree n)) 0L set in
+		(List.length set, span, float_of_int busy /. float_of_int ncpus, Int64.neg free) in
+	let best = ref None in
+	for seed = 0 to nr_nodes - 1 do
+		if cpus.(seed) <> [] then
+			match grow seed [seed] (memfree seed) (List.length cpus.(seed)) with
+			| None -> ()
+			| Some set ->
+				let s = score set in
+				match !best with
+				| Some (s', _) when compare s' s <= 0 -> ()
+				| _ -> best := Some (s, set)
+	done;
+	match !best with
+	| None -> None
+	| Some (_, set) ->
+		let map = Bytes.make ((Array.length topo + 7) / 8) '\000' in
+		List.iter (fun n -> List.iter (cpumap_set map) cpus.(n)) set;
+		Some { placement_nodes = List.sort compare set; placement_cpumap = map }
+
 external vcpu_context_get: handle -> domid -> int -> string
        = "stub_xc_vcpu_context_get"
 
@@ -202,10 +547,45 @@ external evtchn_reset: handle -> domid -> unit = "stub_xc_evtchn_reset"
 
 external readconsolering: handle -> string = "stub_xc_readconsolering"
 
+type console_reader
+external console_reader_create: int -> console_reader
+       = "stub_xc_console_reader_create"
+external console_reader_read: handle -> console_reader -> string
+       = "stub_xc_console_reader_read"
+external console_reader_read_into: handle -> console_reader -> Bytes.t -> int -> int -> int
+       = "stub_xc_console_reader_read_into"
+
 external send_debug_keys: handle -> string -> unit = "stub_xc_send_debug_keys"
 external physinfo: handle -> physinfo = "stub_xc_physinfo"
 external pcpu_info: handle -> int -> int64 array = "stub_xc_pcpu_info"
 
+type pcpu_busy = (float, Bigarray.float64_elt, Bigarray.c_layout) Bigarray.Array1.t
+type pcpu_sampler
+
+external pcpu_sampler_create: int -> pcpu_sampler = "stub_xc_pcpu_sampler_create"
+external pcpu_sample: handle -> pcpu_sampler -> pcpu_busy -> int = "stub_xc_pcpu_sample"
+
+let pcpu_busy_create n = Bigarray.Array1.create Bigarray.float64 Bigarray.c_layout n
+
+let pcpu_busy_by_group busy n per =
+	if per < 1 then invalid_arg "pcpu_busy_by_group";
+	let groups = (n + per - 1) / per in
+	let sums = Array.make groups 0. in
+	let counts = Array.make groups 0 in
+	for i = 0 to n - 1 do
+		let g = i / per in
+		sums.(g) <- sums.(g) +. Bigarray.Array1.get busy i;
+		counts.(g) <- counts.(g) + 1
+	done;
+	Array.mapi (fun g s -> s /. float_of_int counts.(g)) sums
+
+let pcpu_busy_by_core physinfo busy n =
+	pcpu_busy_by_group busy n physinfo.threads_per_core
+
+let pcpu_busy_by_socket physinfo busy n =
+	pcpu_busy_by_group busy n
+		(physinfo.threads_per_core * physinfo.cores_per_socket)
+
 external domain_setmaxmem: handle -> domid -> int64 -> unit
        = "stub_xc_domain_setmaxmem"
 external domain_set_memmap_limit: handle -> domid -> int64 -> unit
@@ -229,6 +609,147 @@ external map_foreign_range: handle -> domid -> int
                          -> nativeint -> Xenmmap.mmap_interface
        = "stub_map_foreign_range"
 
+external map_foreign_bulk: handle -> domid -> Xenmmap.mmap_prot_flag
+                        -> int64_column -> int32_column -> Xenmmap.mmap_interface
+       = "stub_map_foreign_bulk"
+
+(* Bounded per-domain cache of single-page foreign mappings, evicting the
+   least recently used page of a domain when it is full *)
+(* The pages of a domain are kept in a list from most to least recently
+   used, so that both a hit and an eviction are O(1) *)
+type foreign_map_entry =
+{
+	fme_mfn           : nativeint;
+	fme_map           : Xenmmap.mmap_interface;
+	mutable fme_prev  : foreign_map_entry option; (* more recently used *)
+	mutable fme_next  : foreign_map_entry option; (* less recently used *)
+}
+
+type foreign_map_domain =
+{
+	fmd_pages        : (nativeint, foreign_map_entry) Hashtbl.t;
+	mutable fmd_mru  : foreign_map_entry option;
+	mutable fmd_lru  : foreign_map_entry option;
+}
+
+type foreign_map_cache =
+{
+	fmc_per_domain         : int;
+	fmc_domains            : (domid, foreign_map_domain) Hashtbl.t;
+	mutable fmc_hits       : int;
+	mutable fmc_misses     : int;
+	mutable fmc_evictions  : int;
+}
+
+type foreign_map_cache_stats =
+{
+	hits      : int;
+	misses    : int;
+	evictions : int;
+	mapped    : int;
+}
+
+let fmd_unlink d e =
+	(match e.fme_prev with
+	 | Some p -> p.fme_next <- e.fme_next
+	 | None -> d.fmd_mru <- e.fme_next);
+	(match e.fme_next with
+	 | Some n -> n.fme_prev <- e.fme_prev
+	 | None -> d.fmd_lru <- e.fme_prev);
+	e.fme_prev <- None;
+	e.fme_next <- None
+
+let fmd_push_front d e =
+	let node = Some e in
+	e.fme_next <- d.fmd_mru;
+	(match d.fmd_mru with
+	 | Some m -> m.fme_prev <- node
+	 | None -> d.fmd_lru <- node);
+	d.fmd_mru <- node
+
+let foreign_map_cache_evict_lru cache d =
+	match d.fmd_lru with
+	| None -> ()
+	| Some e ->
+		fmd_unlink d e;
+		Hashtbl.remove d.fmd_pages e.fme_mfn;
+		Xenmmap.unmap e.fme_map;
+		cache.fmc_evictions <- cache.fmc_evictions + 1
+
+let map_foreign_cached cache handle domid mfn =
+	let d =
+		try Hashtbl.find cache.fmc_domains domid
+		with Not_found ->
+			let d = {
+				fmd_pages = Hashtbl.create cache.fmc_per_domain;
+				fmd_mru = None;
+				fmd_lru = None;
+			} in
+			Hashtbl.replace cache.fmc_domains domid d;
+			d in
+	try
+		let e = Hashtbl.find d.fmd_pages mfn in
+		(match d.fmd_mru with
+		 | Some m when m == e -> ()
+		 | _ -> fmd_unlink d e; fmd_push_front d e);
+		cache.fmc_hits <- cache.fmc_hits + 1;
+		e.fme_map
+	with Not_found ->
+		cache.fmc_misses <- cache.fmc_misses + 1;
+		let map = map_foreign_range handle domid (Xenmmap.getpagesize ()) mfn in
+		if Hashtbl.length d.fmd_pages >= cache.fmc_per_domain
+		then foreign_map_cache_evict_lru cache d;
+		let e = { fme_mfn = mfn; fme_map = map; fme_prev = None; fme_next = None } in
+		Hashtbl.replace d.fmd_pages mfn e;
+		fmd_push_front d e;
+		map
+
+let foreign_map_cache_invalidate cache domid =
+	try
+		let d = Hashtbl.find cache.fmc_domains domid in
+		Hashtbl.iter (fun _ e -> Xenmmap.unmap e.fme_map) d.fmd_pages;
+		Hashtbl.remove cache.fmc_domains domid
+	with Not_found -> ()
+
+let foreign_map_cache_handle_changes cache changes =
+	List.iter (function
+		| Domain_destroyed domid -> foreign_map_cache_invalidate cache domid
+		| Domain_created di | Domain_changed di ->
+			if di.dying then foreign_map_cache_invalidate cache di.domid)
+		changes
+
+let foreign_map_cache_create ?watcher per_domain =
+	if per_domain < 1 then invalid_arg "foreign_map_cache_create";
+	let cache = {
+		fmc_per_domain = per_domain;
+		fmc_domains = Hashtbl.create 16;
+		fmc_hits = 0;
+		fmc_misses = 0;
+		fmc_evictions = 0;
+	} in
+	(match watcher with
+	 | Some w -> domain_watcher_on_changes w (foreign_map_cache_handle_changes cache)
+	 | None -> ());
+	cache
+
+let foreign_map_cache_prune cache handle =
+	let live = Hashtbl.create 64 in
+	Array.iter (fun di -> if not di.dying then Hashtbl.replace live di.domid ())
+		(domain_getinfolist_array handle 0);
+	let dead = Hashtbl.fold (fun domid _ acc ->
+		if Hashtbl.mem live domid then acc else domid :: acc)
+		cache.fmc_domains [] in
+	List.iter (foreign_map_cache_invalidate cache) dead
+
+let foreign_map_cache_stats cache =
+	{
+		hits = cache.fmc_hits;
+		misses = cache.fmc_misses;
+		evictions = cache.fmc_evictions;
+		mapped = Hashtbl.fold (fun _ d acc -> acc + Hashtbl.length d.fmd_pages)
+			cache.fmc_domains 0;
+	}
+
 external domain_assign_device: handle -> domid -> (int * int * int * int) -> unit
        = "stub_xc_domain_assign_device"
 external domain_deassign_device: handle -> domid -> (int * int * int * int) -> unit
@@ -239,6 +760,27 @@ external domain_test_assign_device: handle -> domid -> (int * int * int * int) -
 external domain_get_runstate_info : handle -> int -> runstateinfo
        = "stub_xc_get_runstate_info"
 
+type runstate_matrix = (int64, Bigarray.int64_elt, Bigarray.c_layout) Bigarray.Array2.t
+
+let runstate_col_domid            = 0
+let runstate_col_state            = 1
+let runstate_col_missed_changes   = 2
+let runstate_col_state_entry_time = 3
+let runstate_col_time n =
+	if n < 0 || n > 5 then invalid_arg "runstate_col_time";
+	4 + n
+let runstate_nr_cols              = 10
+
+let runstate_matrix_create n =
+	Bigarray.Array2.create Bigarray.int64 Bigarray.c_layout n runstate_nr_cols
+
+type runstate_sampler
+
+external runstate_sampler_create : unit -> runstate_sampler
+       = "stub_xc_runstate_sampler_create"
+external runstate_sample : handle -> runstate_sampler -> bool -> runstate_matrix -> int
+       = "stub_xc_runstate_sample"
+
 external version: handle -> version = "stub_xc_version_version"
 external version_compile_info: handle -> compile_info
        = "stub_xc_version_compile_info"
@@ -252,6 +794,25 @@ external get_cpu_featureset : handle -> featureset_index -> int64 array = "stub_
 external upgrade_oldstyle_featuremask: handle -> int64 array -> bool -> int64 array = "stub_upgrade_oldstyle_featuremask"
 external oldstyle_featuremask: handle -> int64 array = "stub_oldstyle_featuremask"
 
+type featureset = int32_column
+
+external get_cpu_featureset_packed: handle -> featureset_index -> featureset
+       = "stub_xc_get_cpu_featureset_packed"
+external featureset_inter: featureset -> featureset -> featureset = "stub_featureset_inter"
+external featureset_union: featureset -> featureset -> featureset = "stub_featureset_union"
+external featureset_diff: featureset -> featureset -> featureset = "stub_featureset_diff"
+external featureset_subset: featureset -> featureset -> bool = "stub_featureset_subset" "noalloc"
+external featureset_popcount: featureset -> int = "stub_featureset_popcount" "noalloc"
+external featureset_level: featureset array -> featureset = "stub_featureset_level"
+
+let featureset_of_array a =
+	Bigarray.Array1.of_array Bigarray.int32 Bigarray.c_layout
+		(Array.map Int64.to_int32 a)
+
+let featureset_to_array fs =
+	Array.init (Bigarray.Array1.dim fs) (fun i ->
+		Int64.logand (Int64.of_int32 (Bigarray.Array1.get fs i)) 0xffffffffL)
+
 external watchdog : handle -> int -> int32 -> int
   = "stub_xc_watchdog"
 
@@ -270,4 +831,58 @@ external xen_wmb : unit -> unit = "stub_xen_wmb" "noalloc"
 
 external hvm_check_pvdriver : handle -> domid -> bool = "stub_xc_hvm_check_pvdriver"
 
+module Stats = struct
+	type op =
+	{
+		name     : string;
+		calls    : int64;
+		errors   : int64;
+		total_ns : int64;
+		buckets  : int64 array;
+	}
+
+	external set_enabled : bool -> unit = "stub_xc_stats_set_enabled" "noalloc"
+	external enabled : unit -> bool = "stub_xc_stats_enabled" "noalloc"
+	external reset : unit -> unit = "stub_xc_stats_reset" "noalloc"
+	external raw_snapshot : unit -> op list = "stub_xc_stats_snapshot"
+
+	let nr_buckets = 38
+
+	let bucket_bound_ns i =
+		if i >= nr_buckets - 1 then None else Some (Int64.shift_left 1L i)
+
+	let snapshot () =
+		List.sort (fun a b -> compare a.name b.name) (raw_snapshot ())
+
+	let to_prometheus ops =
+		let b = Buffer.create 4096 in
+		let seconds ns = Int64.to_float ns /. 1e9 in
+		Buffer.add_string b
+			"# HELP xenctrl_call_seconds Time spent in libxc calls.\n\
+			 # TYPE xenctrl_call_seconds histogram\n";
+		List.iter (fun op ->
+			let cumulative = ref 0L in
+			Array.iteri (fun i n ->
+				cumulative := Int64.add !cumulative n;
+				let le = match bucket_bound_ns i with
+					| Some ns -> Printf.sprintf "%g" (seconds ns)
+					| None -> "+Inf" in
+				Printf.bprintf b "xenctrl_call_seconds_bucket{op=\"%s\",le=\"%s\"} %Ld\n"
+					op.name le !cumulative)
+				op.buckets;
+			Printf.bprintf b "xenctrl_call_seconds_sum{op=\"%s\"} %g\n"
+				op.name (seconds op.total_ns);
+			Printf.bprintf b "xenctrl_call_seconds_count{op=\"%s\"} %Ld\n"
+				op.name op.calls)
+			ops;
+		Buffer.add_string b
+			"# HELP xenctrl_call_errors_total libxc calls which failed.\n\
+			 # TYPE xenctrl_call_errors_total counter\n";
+		List.iter (fun op ->
+			Printf.bprintf b "xenctrl_call_errors_total{op=\"%s\"} %Ld\n"
+				op.name op.errors)
+			ops;
+		Buffer.contents b
+end
+
 let _ = Callback.register_exception "xc.error" (Error "register_callback")
@@ -19,7 +19,9 @@
 (** {2 Initialization functions} *)
 
 type handle
-(** Type of a libxc handle. Corresponding to libxc's [xc_interface*] *)
+(** Type of a libxc handle. Corresponding to libxc's [xc_interface*]
+    Handles compare equal if they refer to the same interface. A handle
+    is not closed when it is garbage collected. *)
 
 (** General error exception *)
 exception Error of string
@@ -58,6 +60,37 @@ val with_intf : (handle -> 'a) -> 'a
 (** [with_intf f] calls [f] with a freshly opened handle as
     argument. *)
 
+external handle_buffer_grows : handle -> int = "stub_xc_handle_buffer_grows"
+(** [handle_buffer_grows xch] is the number of times the hypercall
+    buffer which [xch] keeps for the polling functions has been
+    reallocated. Once it has seen the largest result, it stays put. *)
+
+
+type handle_pool
+(** A bounded set of handles shared by the threads of a process, so
+    that each thread issues its hypercalls on a handle of its own
+    without opening one per call. The idle handles are closed when the
+    pool is garbage collected. A handle still checked out at that point
+    is left open, and it is up to its holder to [interface_close] it. *)
+
+external handle_pool_create : int -> handle_pool = "stub_xc_handle_pool_create"
+(** [handle_pool_create n] is a pool of up to [n] handles, opened on
+    first use. *)
+
+external handle_pool_checkout : handle_pool -> handle = "stub_xc_handle_pool_checkout"
+(** [handle_pool_checkout pool] is a handle that no other thread holds.
+    It does not take any lock, and releases the runtime lock while it
+    opens a handle. If all [n] handles are in use, a new handle is
+    opened, and it is closed when it is returned. *)
+
+external handle_pool_return : handle_pool -> handle -> unit = "stub_xc_handle_pool_return"
+(** [handle_pool_return pool xch] gives back a handle obtained from
+    [handle_pool_checkout pool]. *)
+
+val with_pool_intf : handle_pool -> (handle -> 'a) -> 'a
+(** [with_pool_intf pool f] calls [f] with a handle checked out of
+    [pool], and returns it afterwards. *)
+
 
 (** {2 Physical host query functions} *)
 
@@ -84,6 +117,35 @@ external pcpu_info: handle -> int -> int64 array = "stub_xc_pcpu_info"
 (** [pcpu_info xch i] is the cpu info array for the physical CPU
     [i]. *)
 
+type pcpu_busy = (float, Bigarray.float64_elt, Bigarray.c_layout) Bigarray.Array1.t
+(** The busy fraction, between 0 and 1, of each physical CPU. *)
+
+type pcpu_sampler
+(** Remembers the idle time of every physical CPU at the previous
+    sample. A sampler must not be used from two threads at once. *)
+
+external pcpu_sampler_create : int -> pcpu_sampler = "stub_xc_pcpu_sampler_create"
+(** [pcpu_sampler_create nr_cpus] is a sampler for the first [nr_cpus]
+    physical CPUs, usually [(physinfo xch).nr_cpus]. *)
+
+external pcpu_sample : handle -> pcpu_sampler -> pcpu_busy -> int = "stub_xc_pcpu_sample"
+(** [pcpu_sample xch s busy] writes into [busy] the busy fraction of
+    each physical CPU since the previous sample taken with [s], and
+    returns the number of entries written. The first sample only
+    records a baseline and returns 0. *)
+
+val pcpu_busy_create : int -> pcpu_busy
+
+val pcpu_busy_by_core : physinfo -> pcpu_busy -> int -> float array
+(** [pcpu_busy_by_core physinfo busy n] averages the first [n] entries
+    of [busy] over each core, assuming Xen numbers the threads of a core
+    consecutively. *)
+
+val pcpu_busy_by_socket : physinfo -> pcpu_busy -> int -> float array
+(** [pcpu_busy_by_socket physinfo busy n] averages the first [n] entries
+    of [busy] over each socket, assuming Xen numbers the cores of a
+    socket consecutively. *)
+
 
 (** {2 Xen get/set functions} *)
 
@@ -150,6 +212,67 @@ type runstateinfo = {
   time5 : int64;
 }
 
+type domain_change =
+  | Domain_created of domaininfo
+  | Domain_destroyed of domid
+  | Domain_changed of domaininfo
+(** A difference between two successive views of the domains of a
+    host. A domid which was destroyed and reused between two polls is
+    reported as [Domain_destroyed] followed by [Domain_created]. *)
+
+type domain_tracker
+(** Remembers the domain table seen by the last call to
+    [domain_getinfo_changes]. A tracker must not be used from two
+    threads at once. *)
+
+type int32_column = (int32, Bigarray.int32_elt, Bigarray.c_layout) Bigarray.Array1.t
+type int64_column = (int64, Bigarray.int64_elt, Bigarray.c_layout) Bigarray.Array1.t
+
+type domaininfo_snapshot = private {
+  snap_domid : int32_column;
+  snap_flags : int32_column; (** raw [XEN_DOMINF_*] flags, see [dominf_*] *)
+  snap_tot_pages : int64_column;
+  snap_max_pages : int64_column;
+  snap_shared_info_frame : int64_column;
+  snap_cpu_time : int64_column;
+  snap_nr_online_vcpus : int32_column;
+  snap_max_vcpu_id : int32_column;
+  snap_ssidref : int32_column;
+  snap_handle : (int, Bigarray.int8_unsigned_elt, Bigarray.c_layout) Bigarray.Array2.t;
+  (** one row of 16 bytes per slot *)
+  snap_raw : (char, Bigarray.int8_unsigned_elt, Bigarray.c_layout) Bigarray.Array1.t;
+  (** hypercall buffer, reused across polls *)
+}
+(** Struct-of-arrays view of the [domaininfo] records of a host. Each
+    column is indexed by slot; slot [i] of every column describes the
+    same domain. *)
+
+type uuid
+(** A domain handle, held as its 16 raw bytes. Values compare and hash
+    by content, so they can be used as [Hashtbl] keys. *)
+
+val uuid_of_string : string -> uuid
+(** [uuid_of_string s] parses the canonical
+    ["xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx"] form, in either case.
+    Raises [Invalid_argument] on anything else. *)
+
+val uuid_to_string : uuid -> string
+(** [uuid_to_string u] is the canonical lower case form of [u]. *)
+
+val uuid_of_bytes : string -> uuid
+(** [uuid_of_bytes s] is the uuid whose raw bytes are [s]. Raises
+    [Invalid_argument] unless [s] is 16 bytes long. *)
+
+val uuid_to_bytes : uuid -> string
+(** [uuid_to_bytes u] is the 16 raw bytes of [u]. *)
+
+val uuid_of_handle : int array -> uuid
+(** [uuid_of_handle info.handle] is the uuid of a [domaininfo]. Raises
+    [Invalid_argument] unless the array has 16 elements. *)
+
+val handle_of_uuid : uuid -> int array
+(** Inverse of [uuid_of_handle]. *)
+
 type domain_create_flag = CDF_HVM | CDF_HAP
 
 val domain_create : handle -> int32 -> domain_create_flag list -> string -> domid
@@ -168,10 +291,147 @@ external domain_getinfo : handle -> domid -> domaininfo = "stub_xc_domain_getinf
 (** [domain_getinfo xch domid] is the [domaininfo] record for
     [domid]. *)
 
+type call_error = {
+  errno : int; (** the errno of the failed call, e.g. ESRCH = 3 *)
+  xc_code : int; (** the libxc [xc_error_code], 0 if none *)
+}
+(** Why a [_result] query failed. Nothing is formatted until
+    [call_error_message] is called. *)
+
+external call_error_message : call_error -> string = "stub_xc_call_error_message"
+(** The message [Error] would have carried, without libxc's detailed
+    message for the call, which is not kept. *)
+
+val raise_call_error : call_error -> 'a
+(** Raises [Error] with [call_error_message]. *)
+
+external domain_exists : handle -> domid -> bool = "stub_xc_domain_exists"
+(** [domain_exists xch domid] is [true] if [domid] exists. A domain that
+    does not exist costs no exception; [Error] is raised only if the
+    query itself fails. *)
+
+external domain_getinfo_result : handle -> domid -> (domaininfo, call_error) result = "stub_xc_domain_getinfo_result"
+(** Same as [domain_getinfo], returning the error instead of raising.
+    A domain which does not exist is reported with errno ESRCH. *)
+
+external domain_getinfolist_result : handle -> domid -> (domaininfo array, call_error) result = "stub_xc_domain_getinfolist_result"
+(** Same as [domain_getinfolist_array], returning the error instead of
+    raising. *)
+
 val domain_getinfolist : handle -> domid -> domaininfo list
 (** [domain_getinfolist xch domid] is the list of all the [domaininfo]
     records starting from [domid] included. *)
 
+external domain_getinfolist_array : handle -> domid -> domaininfo array = "stub_xc_domain_getinfolist"
+(** [domain_getinfolist_array xch domid] is the array of all the
+    [domaininfo] records starting from [domid] included, in increasing
+    domid order. The whole list is fetched in as few hypercalls as
+    possible, so prefer this over [domain_getinfolist] on large hosts. *)
+
+external domain_tracker_create : unit -> domain_tracker = "stub_xc_domain_tracker_create"
+(** [domain_tracker_create ()] is a tracker which has not seen any
+    domain yet. *)
+
+external domain_getinfo_changes : handle -> domain_tracker -> int * domain_change list = "stub_xc_domain_getinfo_changes"
+(** [domain_getinfo_changes xch tracker] is [(generation, changes)]
+    where [changes] lists, in increasing domid order, the domains which
+    were created or destroyed, or whose flags, shutdown code, memory or
+    vcpu count changed since the previous call with [tracker]. The
+    first call reports every domain as created. [generation] is bumped
+    by every call which reports at least one change. *)
+
+type domain_watcher
+(** Watches for domains shutting down or dying through [VIRQ_DOM_EXC]
+    instead of polling, where the virq is available. *)
+
+val domain_watcher_create : unit -> domain_watcher
+(** [domain_watcher_create ()] binds [VIRQ_DOM_EXC] on a new event
+    channel handle. Only one binding of this virq may exist per domain,
+    and on most hosts xenstored already holds it: the watcher then
+    falls back to polling with a [domain_tracker], and
+    [domain_watcher_fd] is [None]. *)
+
+val domain_watcher_fd : domain_watcher -> Unix.file_descr option
+(** [domain_watcher_fd w] becomes readable when Xen raises
+    [VIRQ_DOM_EXC]. It is [None] if the watcher is polling, in which
+    case [domain_watcher_changes] should be called on a timer. *)
+
+val domain_watcher_changes : handle -> domain_watcher -> int * domain_change list
+(** [domain_watcher_changes xch w] acknowledges any pending event and,
+    if there was one, returns the changes since the previous call as
+    [domain_getinfo_changes] does. If no event was pending, no
+    hypercall is made and the change list is empty. A polling watcher
+    always queries. The first call always reports every domain. Domain
+    creation does not raise the virq, so new domains show up on the
+    next wakeup. *)
+
+val domain_watcher_on_changes : domain_watcher -> (domain_change list -> unit) -> unit
+(** [domain_watcher_on_changes w f] makes every later call to
+    [domain_watcher_changes] which finds changes pass them to [f] as
+    well, before returning them. Listeners run in the order they were
+    added. *)
+
+val domain_watcher_close : domain_watcher -> unit
+(** [domain_watcher_close w] unbinds the virq and closes the event
+    channel handle. It is safe to call it more than once. *)
+
+type uuid_index
+(** Maps the uuids of the domains of a host to their domids and back.
+    An index must not be used from two threads at once. *)
+
+val uuid_index_create : unit -> uuid_index
+(** [uuid_index_create ()] is an empty index. *)
+
+val uuid_index_update : uuid_index -> domaininfo array -> unit
+(** [uuid_index_update idx infos] brings [idx] in line with [infos], as
+    returned by [domain_getinfolist_array] from domid 0: domains whose
+    handle is new or changed are (re)indexed and domains missing from
+    [infos] are dropped. Unchanged domains cost a lookup. *)
+
+val uuid_index_apply_changes : uuid_index -> domain_change list -> unit
+(** [uuid_index_apply_changes idx changes] updates [idx] from the
+    output of [domain_getinfo_changes] or [domain_watcher_changes],
+    which report a new handle as the domain being destroyed and
+    created again. *)
+
+val uuid_index_find : uuid_index -> uuid -> domid option
+(** [uuid_index_find idx uuid] is the domain with handle [uuid]. If
+    several domains share a handle, the one indexed last wins. *)
+
+val uuid_index_uuid : uuid_index -> domid -> uuid option
+(** [uuid_index_uuid idx domid] is the handle of [domid]. *)
+
+val uuid_index_length : uuid_index -> int
+(** Number of domains in the index. *)
+
+external domaininfo_snapshot_create : int -> domaininfo_snapshot = "stub_xc_domaininfo_snapshot_create"
+(** [domaininfo_snapshot_create n] allocates a snapshot with room for
+    [n] domains. The snapshot is meant to be reused across polls. *)
+
+val domaininfo_snapshot_capacity : domaininfo_snapshot -> int
+(** [domaininfo_snapshot_capacity snap] is the number of slots of
+    [snap]. *)
+
+external domain_getinfolist_snapshot : handle -> domid -> domaininfo_snapshot -> int = "stub_xc_domain_getinfolist_snapshot"
+(** [domain_getinfolist_snapshot xch domid snap] fills the first slots
+    of [snap] with the domains starting from [domid] included, using a
+    single hypercall and without allocating on the OCaml heap. It
+    returns the number of slots filled. If this is equal to the capacity
+    of [snap] there may be more domains: poll again from the next domid,
+    or use a bigger snapshot. *)
+
+val dominf_dying : int
+val dominf_hvm_guest : int
+val dominf_shutdown : int
+val dominf_paused : int
+val dominf_blocked : int
+val dominf_running : int
+(** Bits of the [snap_flags] column. *)
+
+val dominf_shutdown_code : int -> int
+(** [dominf_shutdown_code flags] is the shutdown code encoded in
+    [flags]. *)
+
 external domain_setmaxmem : handle -> domid -> int64 -> unit = "stub_xc_domain_setmaxmem"
 (** [domain_setmaxmem xch domid max] sets the maximum memory usable by
     [domid] to [max]. *)
@@ -185,6 +445,63 @@ external shadow_allocation_get : handle -> domid -> int = "stub_shadow_allocatio
 external domain_set_memmap_limit : handle -> domid -> int64 -> unit = "stub_xc_domain_set_memmap_limit"
 external domain_memory_increase_reservation : handle -> domid -> int64 -> unit = "stub_xc_domain_memory_increase_reservation"
 external map_foreign_range : handle -> domid -> int -> nativeint -> Xenmmap.mmap_interface = "stub_map_foreign_range"
+(** [map_foreign_range xch domid size mfn] maps [size] bytes of [domid]
+    from frame [mfn] on.
+    @raise Invalid_argument if [size] is not a positive multiple of the
+    page size, or does not fit in a C int. *)
+
+type foreign_map_cache
+(** A bounded cache of single-page foreign mappings keyed by domain and
+    frame, for pages which are mapped over and over again such as rings
+    or the generation-ID page. A cache must not be used from two threads
+    at once. *)
+
+type foreign_map_cache_stats = {
+  hits : int;
+  misses : int;
+  evictions : int;
+  mapped : int; (** pages currently mapped *)
+}
+
+val foreign_map_cache_create : ?watcher:domain_watcher -> int -> foreign_map_cache
+(** [foreign_map_cache_create n] is a cache holding at most [n] mapped
+    pages per domain, evicting the least recently used page first. With
+    [~watcher], the cache invalidates the pages of a domain as soon as
+    [domain_watcher_changes w] reports it dying or destroyed. *)
+
+val map_foreign_cached : foreign_map_cache -> handle -> domid -> nativeint -> Xenmmap.mmap_interface
+(** [map_foreign_cached cache xch domid mfn] is a read-write mapping of
+    page [mfn] of [domid], as [map_foreign_range xch domid pagesize mfn]
+    would return, reusing a cached mapping if there is one. The mapping
+    is owned by the cache: do not unmap it, and do not use it after a
+    later call on the same domain may have evicted it. Eviction and
+    invalidation unmap it, so [Xenmmap.read] and [Xenmmap.write] then
+    raise; a [Xenmmap.to_bigarray] view taken earlier keeps the page
+    mapped but no longer belongs to the cache, and still shows the old
+    frame, even if the domain is gone. *)
+
+val foreign_map_cache_invalidate : foreign_map_cache -> domid -> unit
+(** [foreign_map_cache_invalidate cache domid] unmaps every cached page
+    of [domid]. *)
+
+val foreign_map_cache_handle_changes : foreign_map_cache -> domain_change list -> unit
+(** [foreign_map_cache_handle_changes cache changes] invalidates the
+    domains which [changes], as returned by [domain_getinfo_changes] or
+    [domain_watcher_changes], report as dying or destroyed. *)
+
+val foreign_map_cache_prune : foreign_map_cache -> handle -> unit
+(** [foreign_map_cache_prune cache xch] invalidates every cached domain
+    which is dying or no longer exists. *)
+
+val foreign_map_cache_stats : foreign_map_cache -> foreign_map_cache_stats
+
+external map_foreign_bulk : handle -> domid -> Xenmmap.mmap_prot_flag -> int64_column -> int32_column -> Xenmmap.mmap_interface = "stub_map_foreign_bulk"
+(** [map_foreign_bulk xch domid prot frames errors] maps every frame of
+    [frames], which need not be contiguous, into one contiguous region
+    with a single privcmd batch. Page [i] of the region maps
+    [frames.{i}]. [errors] must be as long as [frames]; [errors.{i}] is
+    set to 0 if frame [i] was mapped, or to a negative errno otherwise.
+    It raises only if the whole batch fails. *)
 
 type featureset_index = Featureset_raw | Featureset_host | Featureset_pv | Featureset_hvm
 external get_cpu_featureset : handle -> featureset_index -> int64 array = "stub_xc_get_cpu_featureset"
@@ -192,6 +509,35 @@ external get_cpu_featureset : handle -> featureset_index -> int64 array = "stub_
 external upgrade_oldstyle_featuremask: handle -> int64 array -> bool -> int64 array = "stub_upgrade_oldstyle_featuremask"
 external oldstyle_featuremask: handle -> int64 array = "stub_oldstyle_featuremask"
 
+type featureset = int32_column
+(** A featureset packed as 32-bit words, in the same order as the
+    [int64 array] featuresets. A featureset shorter than another is
+    treated as padded with zero words. *)
+
+external get_cpu_featureset_packed : handle -> featureset_index -> featureset = "stub_xc_get_cpu_featureset_packed"
+(** Same as [get_cpu_featureset], returning a packed featureset. *)
+
+external featureset_inter : featureset -> featureset -> featureset = "stub_featureset_inter"
+external featureset_union : featureset -> featureset -> featureset = "stub_featureset_union"
+
+external featureset_diff : featureset -> featureset -> featureset = "stub_featureset_diff"
+(** [featureset_diff a b] is the features of [a] which are not in [b]. *)
+
+external featureset_subset : featureset -> featureset -> bool = "stub_featureset_subset" "noalloc"
+(** [featureset_subset a b] is [true] if every feature of [a] is in [b],
+    i.e. a VM levelled to [a] may run on a host offering [b]. *)
+
+external featureset_popcount : featureset -> int = "stub_featureset_popcount" "noalloc"
+(** The number of features in a featureset. *)
+
+external featureset_level : featureset array -> featureset = "stub_featureset_level"
+(** [featureset_level hosts] is the intersection of every featureset of
+    [hosts], computed in one pass: the featureset of a pool levelled to
+    run on each of its hosts. [hosts] must not be empty. *)
+
+val featureset_of_array : int64 array -> featureset
+val featureset_to_array : featureset -> int64 array
+
 
 (** {3 Domain lifecycle ops} *)
 
@@ -223,6 +569,24 @@ external domain_destroy : handle -> domid -> unit = "stub_xc_domain_destroy"
     called after sending the domain a SHUTDDOWN control message to free up
     the domain resources. *)
 
+val domain_pause_many : handle -> domid array -> int array
+(** [domain_pause_many xch domids] pauses every domain of [domids] with
+    the runtime lock released once. Element [i] of the result is 0 if
+    [domids.(i)] was paused, or the errno of the failure otherwise; no
+    exception is raised for a single domain. *)
+
+val domain_unpause_many : handle -> domid array -> int array
+(** Same as [domain_pause_many], unpausing. *)
+
+val domain_shutdown_many : handle -> domid array -> shutdown_reason -> int array
+(** Same as [domain_pause_many], shutting down with [reason]. *)
+
+val domain_destroy_many : ?workers:int -> handle -> domid array -> int array
+(** Same as [domain_pause_many], destroying. With [workers] greater than
+    1, up to [workers] threads destroy domains concurrently, which pays
+    off when the domains have a lot of memory to relinquish. The calling
+    thread uses [xch], and each other thread a handle of its own. *)
+
 
 external watchdog : handle -> domid -> int32 -> int = "stub_xc_watchdog"
 (** [watchdog xch domid timeout] turns on the watchdog for domain
@@ -242,6 +606,32 @@ external domain_get_vcpuinfo : handle -> domid -> int -> vcpuinfo = "stub_xc_vcp
 (** [domain_get_vcpuinfo xch domid v] is the [vcpuinfo] record for
     vcpu [v] of domain [domid]. *)
 
+external domain_get_vcpuinfo_result : handle -> domid -> int -> (vcpuinfo, call_error) result = "stub_xc_vcpu_getinfo_result"
+(** Same as [domain_get_vcpuinfo], returning the error instead of
+    raising. *)
+
+type vcpuinfo_matrix = (int64, Bigarray.int64_elt, Bigarray.c_layout) Bigarray.Array2.t
+(** One row per vcpu, indexed by the [vcpuinfo_col_*] columns. Boolean
+    columns hold [0L] or [1L]. *)
+
+val vcpuinfo_col_domid : int
+val vcpuinfo_col_vcpu : int
+val vcpuinfo_col_online : int
+val vcpuinfo_col_blocked : int
+val vcpuinfo_col_running : int
+val vcpuinfo_col_cputime : int
+val vcpuinfo_col_cpu : int
+
+external domain_get_all_vcpuinfo : handle -> domid -> vcpuinfo_matrix = "stub_xc_domain_get_all_vcpuinfo"
+(** [domain_get_all_vcpuinfo xch domid] is the [vcpuinfo] of every
+    vcpu of [domid], from 0 to its [max_vcpu_id], gathered in a single
+    call. *)
+
+external all_domains_get_vcpuinfo : handle -> vcpuinfo_matrix = "stub_xc_all_domains_get_vcpuinfo"
+(** [all_domains_get_vcpuinfo xch] is the [vcpuinfo] of every vcpu of
+    every domain on the host, in increasing domid order. Domains
+    destroyed during the call are left out. *)
+
 external vcpu_affinity_get : handle -> domid -> int -> bool array = "stub_xc_vcpu_getaffinity"
 (** [vcpu_affinity_get xch domid v] is the affinity array for vcpu [v]
     in domain [domid]. For each physical CPUs [i], [affinity.(i)] will
@@ -253,6 +643,93 @@ external vcpu_affinity_set : handle -> domid -> int -> bool array -> unit = "stu
     documentation of the previous function about the affinities
     array. *)
 
+type cpumap = Bytes.t
+(** A set of physical CPUs in libxc's [xc_cpumap_t] layout: bit [i mod 8]
+    of byte [i / 8] is set if CPU [i] is in the set. Converting to and
+    from libxc is a single copy. *)
+
+external cpumap_size : handle -> int = "stub_xc_cpumap_size"
+(** [cpumap_size xch] is the size in bytes of a cpumap covering every
+    physical CPU of the host. *)
+
+val cpumap_create : handle -> cpumap
+(** [cpumap_create xch] is an empty cpumap of [cpumap_size xch]
+    bytes. *)
+
+val cpumap_mem : cpumap -> int -> bool
+val cpumap_set : cpumap -> int -> unit
+val cpumap_clear : cpumap -> int -> unit
+
+external vcpu_affinity_set_cpumap : handle -> domid -> int -> cpumap -> unit = "stub_xc_vcpu_setaffinity_cpumap"
+(** Same as [vcpu_affinity_set], with a cpumap. A cpumap shorter than
+    [cpumap_size] is padded with zeroes. *)
+
+external vcpu_affinity_get_cpumap : handle -> domid -> int -> cpumap = "stub_xc_vcpu_getaffinity_cpumap"
+(** Same as [vcpu_affinity_get], returning a cpumap. *)
+
+external domain_set_affinity_all_vcpus : handle -> domid -> cpumap array -> unit = "stub_xc_domain_set_affinity_all_vcpus"
+(** [domain_set_affinity_all_vcpus xch domid maps] sets the affinity of
+    every vcpu of [domid] in a single call. [maps] either holds one map,
+    applied to every vcpu, or one map per vcpu. *)
+
+type domain_config = {
+  cfg_ssidref : int32;
+  cfg_flags : domain_create_flag list;
+  cfg_max_vcpus : int;
+  cfg_max_memkb : int64;
+  cfg_shadow_mb : int option; (** [shadow_allocation_set], if any *)
+  cfg_address_size : int option; (** [domain_set_machine_address_size], if any *)
+  cfg_sched : sched_control option; (** [sched_credit_domain_set], if any *)
+  cfg_affinity : cpumap array;
+  (** No map, one map applied to every vcpu, or one map per vcpu *)
+}
+
+val domain_create_full : handle -> domain_config -> string -> domid
+(** [domain_create_full xch config uuid] is [domain_create], followed by
+    [domain_max_vcpus], [domain_setmaxmem] and the optional steps of
+    [config], performed in one call with the runtime lock released once.
+    If a step after the creation fails, the domain is destroyed and the
+    error of that step is raised. *)
+
+type cputopo = {
+  core : int;
+  socket : int;
+  node : int;
+}
+(** The position of a physical CPU. Each field is -1 if unknown, for
+    instance if the CPU is offline. *)
+
+type numainfo = {
+  node_memsize : int64 array; (** bytes, or -1 if unknown *)
+  node_memfree : int64 array; (** bytes, or -1 if unknown *)
+  node_distances : int array array;
+  (** [node_distances.(a).(b)] is the distance from node [a] to node [b]
+      as reported by the ACPI SLIT, or -1 if unknown. *)
+}
+
+external cputopoinfo : handle -> cputopo array = "stub_xc_cputopoinfo"
+(** [cputopoinfo xch] is the core, socket and node of each physical
+    CPU, indexed by CPU number. *)
+
+external numainfo : handle -> numainfo = "stub_xc_numainfo"
+(** [numainfo xch] is the memory and distances of each NUMA node,
+    indexed by node number. *)
+
+type numa_placement = {
+  placement_nodes : int list;
+  placement_cpumap : cpumap; (** every pCPU of [placement_nodes] *)
+}
+
+val numa_place : ?node_load:int array -> numainfo -> cputopo array -> vcpus:int -> memory:int64 -> numa_placement option
+(** [numa_place ?node_load numainfo topo ~vcpus ~memory] picks the set
+    of nodes to run a VM with [vcpus] VCPUs and [memory] bytes of RAM on.
+    The set must have at least [memory] bytes free and [vcpus] pCPUs.
+    The fewest nodes win, then the nodes closest to each other, then
+    the nodes with the fewest VCPUs already placed on them per pCPU, as
+    counted by [node_load], then the nodes with the most free memory.
+    [None] if no set of nodes fits. The cpumap can be passed to
+    [domain_set_affinity_all_vcpus]. *)
+
 external vcpu_context_get : handle -> domid -> int -> string = "stub_xc_vcpu_context_get"
 
 
@@ -268,6 +745,40 @@ external domain_test_assign_device: handle -> domid -> (int * int * int * int) -
 
 external domain_get_runstate_info : handle -> int -> runstateinfo = "stub_xc_get_runstate_info"
 
+type runstate_matrix = (int64, Bigarray.int64_elt, Bigarray.c_layout) Bigarray.Array2.t
+(** One row per domain, indexed by the [runstate_col_*] columns. *)
+
+val runstate_col_domid : int
+val runstate_col_state : int
+val runstate_col_missed_changes : int
+val runstate_col_state_entry_time : int
+
+val runstate_col_time : int -> int
+(** [runstate_col_time n] is the column of [time]{i n}, for [n] in
+    0..5. *)
+
+val runstate_nr_cols : int
+
+val runstate_matrix_create : int -> runstate_matrix
+(** [runstate_matrix_create n] is a matrix with room for [n]
+    domains. *)
+
+type runstate_sampler
+(** Remembers the runstate times of the previous sample. A sampler must
+    not be used from two threads at once. *)
+
+external runstate_sampler_create : unit -> runstate_sampler = "stub_xc_runstate_sampler_create"
+
+external runstate_sample : handle -> runstate_sampler -> bool -> runstate_matrix -> int = "stub_xc_runstate_sample"
+(** [runstate_sample xch sampler deltas m] fills the rows of [m] with
+    the runstate info of every domain, in increasing domid order, and
+    returns the number of domains sampled. If that is more than
+    [Bigarray.Array2.dim1 m], only the first rows were filled: grow the
+    matrix and sample again. If [deltas] is [true], the time
+    columns hold the time spent in each state since the previous sample
+    rather than since the domain was created. No OCaml value is
+    allocated per domain. *)
+
 (** {3 Domain eventchn functions} *)
 
 external evtchn_alloc_unbound : handle -> domid -> domid -> int = "stub_xc_evtchn_alloc_unbound"
@@ -277,6 +788,25 @@ external evtchn_reset : handle -> domid -> unit = "stub_xc_evtchn_reset"
 (** {3 Domain console functions} *)
 
 external readconsolering : handle -> string = "stub_xc_readconsolering"
+
+type console_reader
+(** Remembers how far into the hypervisor console ring it has read. A
+    reader must not be used from two threads at once. *)
+
+external console_reader_create : int -> console_reader = "stub_xc_console_reader_create"
+(** [console_reader_create size] is a reader, positioned at the start of
+    the console ring, which reads at most [size] characters per call. *)
+
+external console_reader_read : handle -> console_reader -> string = "stub_xc_console_reader_read"
+(** [console_reader_read xch r] returns the characters written to the
+    console ring since the previous read through [r]. Characters which
+    the ring overwrote in the meantime are lost. *)
+
+external console_reader_read_into : handle -> console_reader -> Bytes.t -> int -> int -> int = "stub_xc_console_reader_read_into"
+(** [console_reader_read_into xch r buf off len] is [console_reader_read]
+    writing at most [len] characters into [buf] at [off] and returning
+    how many it wrote. Characters left over are returned by the next
+    read. *)
 external send_debug_keys : handle -> string -> unit = "stub_xc_send_debug_keys"
 
 
@@ -303,3 +833,42 @@ external xen_rmb : unit -> unit = "stub_xen_rmb" "noalloc"
 external xen_wmb : unit -> unit = "stub_xen_wmb" "noalloc"
 
 external hvm_check_pvdriver : handle -> domid -> bool = "stub_xc_hvm_check_pvdriver"
+
+(** {3 Statistics} *)
+
+(** Call counts, error counts and latency histograms of the libxc calls
+    made by this module, by function. A call made outside any named
+    function is reported as [unknown]. Recording is off by default;
+    while it is off, each call pays for three tests of a flag. *)
+module Stats : sig
+  type op = {
+    name : string; (** the function, e.g. [domain_getinfo] *)
+    calls : int64;
+    errors : int64;
+    (** calls which raised [Error] or [Failure], or returned [Error _] *)
+    total_ns : int64;
+    buckets : int64 array;
+    (** [buckets.(i)] counts the calls which took less than
+        [bucket_bound_ns i] and at least [bucket_bound_ns (i - 1)]. *)
+  }
+
+  external set_enabled : bool -> unit = "stub_xc_stats_set_enabled" "noalloc"
+  external enabled : unit -> bool = "stub_xc_stats_enabled" "noalloc"
+
+  external reset : unit -> unit = "stub_xc_stats_reset" "noalloc"
+  (** Zeroes every counter. Calls in flight may be partially counted. *)
+
+  val bucket_bound_ns : int -> int64 option
+  (** The upper bound of a bucket, [2^i] ns, or [None] for the last
+      bucket, which counts the calls longer than [2^36] ns (about 69 s). *)
+
+  val snapshot : unit -> op list
+  (** The counters of every call made since statistics were first
+      enabled, sorted by name. The counters are read without stopping
+      other threads, so an op may be inconsistent by a call or two. *)
+
+  val to_prometheus : op list -> string
+  (** Renders a snapshot in the Prometheus text exposition format, as
+      the [xenctrl_call_seconds] histogram and the
+      [xenctrl_call_errors_total] counter, labelled by [op]. *)
+end
@@ -17,6 +17,7 @@
 #define _XOPEN_SOURCE 600
 #include <stdlib.h>
 #include <errno.h>
+#include <limits.h>
 
 #define CAML_NAME_SPACE
 #include <caml/alloc.h>
@@ -24,12 +25,17 @@
 #include <caml/signals.h>
 #include <caml/fail.h>
 #include <caml/callback.h>
+#include <caml/bigarray.h>
 
 #include <sys/mman.h>
 #include <stdint.h>
 #include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
 
 #define XC_WANT_COMPAT_MAP_FOREIGN_API
+#define XC_WANT_COMPAT_EVTCHN_API
 #include <xenctrl.h>
 
 #include "mmap_stubs.h"
@@ -39,7 +45,7 @@
 #define PAGE_SIZE               (1UL << PAGE_SHIFT)
 #define PAGE_MASK               (~(PAGE_SIZE-1))
 
-#define _H(__h) ((xc_interface *)(__h))
+#define _H(__h) (Handle_val(__h)->xch)
 #define _D(__d) ((uint32_t)Int_val(__d))
 
 #define Val_none (Val_int(0))
@@ -53,46 +59,592 @@
 	i1 = (uint32_t) Int64_val(Field(input, 0)); \
 	i2 = ((Field(input, 1) == Val_none) ? 0xffffffff : (uint32_t) Int64_val(Field(Field(input, 1), 0)));
 
+/*
+ * Optional per-call statistics. Each stub which calls libxc starts with
+ * XC_STAT_OP, naming the op after the external it implements: its
+ * blocking section, including one entered by a helper it calls, is timed
+ * as a call of that op, and an error it raises or returns is charged to
+ * it. Leaving the blocking section clears the op, so a stub which lacks
+ * one is reported as "unknown" rather than as the stub which ran before
+ * it. Counters are spread over a few shards picked per thread and updated
+ * with relaxed atomics, so recording takes no lock. When statistics are
+ * off, XC_STAT_OP and entering and leaving a blocking section each test
+ * xc_stats_enabled once, and store nothing.
+ */
+#define XC_STAT_SHARDS 8
+/* Buckets 0 to XC_STAT_BUCKETS - 2 are bounded, up to 2^36 ns (about a
+ * minute); the last one counts every longer call */
+#define XC_STAT_BUCKETS 38
+
+struct xc_stat_shard {
+	uint64_t calls;
+	uint64_t errors;
+	uint64_t total_ns;
+	/* bucket i counts calls which took less than 2^i ns, and at least
+	 * 2^(i-1) ns */
+	uint64_t buckets[XC_STAT_BUCKETS];
+} __attribute__((aligned(64)));
+
+struct xc_stat {
+	const char *name;
+	int registered;
+	struct xc_stat *next;
+	struct xc_stat_shard shards[XC_STAT_SHARDS];
+};
+
+static int xc_stats_enabled;
+static struct xc_stat *xc_stats_sites;
+static unsigned int xc_stats_next_shard;
+static struct xc_stat xc_stat_unknown = { .name = "unknown" };
+
+/* The op of the stub this thread is running, from XC_STAT_OP until its
+ * blocking section ends */
+static __thread struct xc_stat *xc_stat_op;
+/* The op being timed, and once its section has ended, the op which an
+ * error raised afterwards is charged to */
+static __thread struct xc_stat *xc_stat_current;
+static __thread uint64_t xc_stat_start;
+static __thread int xc_stat_shard = -1;
+
+#define xc_stats_on() \
+	__builtin_expect(__atomic_load_n(&xc_stats_enabled, __ATOMIC_RELAXED), 0)
+
+static void xc_stats_set_op(struct xc_stat *site)
+{
+	if (xc_stats_on()) {
+		xc_stat_op = site;
+		xc_stat_current = NULL;
+	}
+}
+
+#define XC_STAT_OP(opname) do { \
+	static struct xc_stat xc_stat_site = { .name = opname }; \
+	xc_stats_set_op(&xc_stat_site); \
+} while (0)
+
+static uint64_t xc_stats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static struct xc_stat_shard *xc_stats_shard(struct xc_stat *site)
+{
+	if (xc_stat_shard < 0)
+		xc_stat_shard = __atomic_fetch_add(&xc_stats_next_shard, 1,
+		                                   __ATOMIC_RELAXED) % XC_STAT_SHARDS;
+	return &site->shards[xc_stat_shard];
+}
+
+static void xc_stats_register(struct xc_stat *site)
+{
+	if (!__atomic_exchange_n(&site->registered, 1, __ATOMIC_ACQ_REL)) {
+		struct xc_stat *head = __atomic_load_n(&xc_stats_sites,
+		                                       __ATOMIC_ACQUIRE);
+		do
+			site->next = head;
+		while (!__atomic_compare_exchange_n(&xc_stats_sites, &head, site,
+		                                    1, __ATOMIC_RELEASE,
+		                                    __ATOMIC_ACQUIRE));
+	}
+}
+
+static void xc_stats_begin(void)
+{
+	struct xc_stat *site = xc_stat_op ? xc_stat_op : &xc_stat_unknown;
+
+	xc_stats_register(site);
+	xc_stat_current = site;
+	xc_stat_start = xc_stats_now();
+}
+
+static void xc_stats_end(void)
+{
+	struct xc_stat *site = xc_stat_current;
+	struct xc_stat_shard *shard;
+	uint64_t ns;
+	int bucket;
+
+	xc_stat_op = NULL;
+	/* Statistics were enabled while the section ran */
+	if (!xc_stat_start)
+		return;
+	ns = xc_stats_now() - xc_stat_start;
+	xc_stat_start = 0;
+	bucket = ns ? 64 - __builtin_clzll(ns) : 0;
+	if (bucket >= XC_STAT_BUCKETS)
+		bucket = XC_STAT_BUCKETS - 1;
+
+	shard = xc_stats_shard(site);
+	__atomic_fetch_add(&shard->calls, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&shard->total_ns, ns, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&shard->buckets[bucket], 1, __ATOMIC_RELAXED);
+}
+
+/* Charges an error to the op of the running stub, once */
+static void xc_stats_error(void)
+{
+	struct xc_stat *site = xc_stat_op ? xc_stat_op : xc_stat_current;
+
+	if (!xc_stats_on() || !site)
+		return;
+	xc_stats_register(site);
+	__atomic_fetch_add(&xc_stats_shard(site)->errors, 1, __ATOMIC_RELAXED);
+	xc_stat_op = NULL;
+	xc_stat_current = NULL;
+}
+
+#define xc_blocking_enter() do { \
+	if (xc_stats_on()) \
+		xc_stats_begin(); \
+	caml_enter_blocking_section(); \
+} while (0)
+
+#define xc_blocking_leave() do { \
+	caml_leave_blocking_section(); \
+	if (xc_stats_on()) \
+		xc_stats_end(); \
+} while (0)
+
+/* caml_failwith, counted as an error of the running stub */
+static void xc_failwith(const char *msg) __attribute__((noreturn));
+static void xc_failwith(const char *msg)
+{
+	xc_stats_error();
+	caml_failwith(msg);
+}
+
+CAMLprim value stub_xc_stats_set_enabled(value enabled)
+{
+	__atomic_store_n(&xc_stats_enabled, Bool_val(enabled), __ATOMIC_RELAXED);
+	return Val_unit;
+}
+
+CAMLprim value stub_xc_stats_enabled(value unit)
+{
+	return Val_bool(__atomic_load_n(&xc_stats_enabled, __ATOMIC_RELAXED));
+}
+
+CAMLprim value stub_xc_stats_reset(value unit)
+{
+	struct xc_stat *site;
+
+	for (site = __atomic_load_n(&xc_stats_sites, __ATOMIC_ACQUIRE);
+	     site; site = site->next)
+		memset(site->shards, 0, sizeof(site->shards));
+	return Val_unit;
+}
+
+/* Returns one Xenctrl.Stats.op per site */
+CAMLprim value stub_xc_stats_snapshot(value unit)
+{
+	CAMLparam1(unit);
+	CAMLlocal4(result, cons, op, buckets);
+	struct xc_stat *site;
+	uint64_t calls, errors, total_ns, b[XC_STAT_BUCKETS];
+	int i, j;
+
+	result = Val_emptylist;
+	for (site = __atomic_load_n(&xc_stats_sites, __ATOMIC_ACQUIRE);
+	     site; site = site->next) {
+		calls = errors = total_ns = 0;
+		memset(b, 0, sizeof(b));
+		for (i = 0; i < XC_STAT_SHARDS; i++) {
+			struct xc_stat_shard *s = &site->shards[i];
+
+			calls += __atomic_load_n(&s->calls, __ATOMIC_RELAXED);
+			errors += __atomic_load_n(&s->errors, __ATOMIC_RELAXED);
+			total_ns += __atomic_load_n(&s->total_ns, __ATOMIC_RELAXED);
+			for (j = 0; j < XC_STAT_BUCKETS; j++)
+				b[j] += __atomic_load_n(&s->buckets[j],
+				                        __ATOMIC_RELAXED);
+		}
+
+		buckets = caml_alloc(XC_STAT_BUCKETS, 0);
+		for (j = 0; j < XC_STAT_BUCKETS; j++)
+			Store_field(buckets, j, caml_copy_int64(b[j]));
+		op = caml_alloc_tuple(5);
+		Store_field(op, 0, caml_copy_string(site->name));
+		Store_field(op, 1, caml_copy_int64(calls));
+		Store_field(op, 2, caml_copy_int64(errors));
+		Store_field(op, 3, caml_copy_int64(total_ns));
+		Store_field(op, 4, buckets);
+
+		cons = caml_alloc_small(2, Tag_cons);
+		Field(cons, 0) = op;
+		Field(cons, 1) = result;
+		result = cons;
+	}
+	CAMLreturn(result);
+}
+
 #define ERROR_STRLEN 1024
+/* Raises error, or err if error is XC_ERROR_NONE, as failwith_xc would */
+static void failwith_xc_error(const xc_error *error, int err)
+{
+	char error_str[ERROR_STRLEN];
+
+	xc_stats_error();
+	if (error->code == XC_ERROR_NONE)
+		snprintf(error_str, ERROR_STRLEN, "%d: %s", err, strerror(err));
+	else
+		snprintf(error_str, ERROR_STRLEN, "%d: %s: %s",
+			 error->code,
+			 xc_error_code_to_desc(error->code),
+			 error->message);
+	caml_raise_with_string(*caml_named_value("xc.error"), error_str);
+}
+
 void failwith_xc(xc_interface *xch)
 {
-	static char error_str[ERROR_STRLEN];
-	if (xch) {
-		const xc_error *error = xc_get_last_error(xch);
-		if (error->code == XC_ERROR_NONE)
-                	snprintf(error_str, ERROR_STRLEN, "%d: %s", errno, strerror(errno));
-		else
-			snprintf(error_str, ERROR_STRLEN, "%d: %s: %s",
-				 error->code,
-				 xc_error_code_to_desc(error->code),
-				 error->message);
-	} else {
-		snprintf(error_str, ERROR_STRLEN, "Unable to open XC interface");
+	if (xch)
+		failwith_xc_error(xc_get_last_error(xch), errno);
+	caml_raise_with_string(*caml_named_value("xc.error"),
+			       "Unable to open XC interface");
+}
+
+/* A handle is libxc's xc_interface together with the hypercall buffer of
+ * the polling stubs. The buffer is page-aligned and grows to the largest
+ * size asked of it; it is mlock'd once each time it grows, and lives as
+ * long as the handle, so steady polling neither allocates nor locks
+ * pages. It is claimed with a compare-and-swap on state, without any
+ * global lock; a handle used by two threads at once hands the second a
+ * malloc'd buffer. A handle closed while its buffer is claimed is only
+ * torn down once the holder releases it, so a stub may keep the buffer
+ * while it boxes its results, as long as it releases it before raising.
+ *
+ * The OCaml value of a handle is a custom block holding a pointer to it.
+ * The block may move while the runtime lock is released, so a stub reads
+ * the pointer, or its xc_interface, before its blocking section. The
+ * block does not own the handle: interface_close and the pool close it,
+ * and the pool hands the same handle out again in a new block. */
+#define HANDLE_IDLE    0
+#define HANDLE_HELD    1
+#define HANDLE_CLOSING 2
+
+struct xc_handle {
+	xc_interface *xch;
+	int state;
+	void *data;
+	size_t size;
+	unsigned int grows; /* times data was reallocated */
+};
+
+#define Handle_val(v) (*((struct xc_handle **) Data_custom_val(v)))
+
+/* Handles compare and hash as the pointers they hold */
+static int xc_handle_compare(value a, value b)
+{
+	struct xc_handle *ha = Handle_val(a), *hb = Handle_val(b);
+
+	return ha < hb ? -1 : (ha > hb ? 1 : 0);
+}
+
+static intnat xc_handle_hash(value v)
+{
+	return (intnat) ((uintptr_t) Handle_val(v) >> 4);
+}
+
+static struct custom_operations xc_handle_ops = {
+	"xenctrl.handle",
+	custom_finalize_default,
+	xc_handle_compare,
+	xc_handle_hash,
+	custom_serialize_default,
+	custom_deserialize_default,
+	custom_compare_ext_default,
+};
+
+/* The block is allocated before the handle is opened, so that raising
+ * Out_of_memory cannot leak an open handle */
+static value alloc_xc_handle(void)
+{
+	value v = caml_alloc_custom(&xc_handle_ops, sizeof(struct xc_handle *),
+	                            0, 1);
+
+	Handle_val(v) = NULL;
+	return v;
+}
+
+struct xc_buffer {
+	struct xc_handle *handle; /* NULL if data was malloc'd */
+	void *data;
+	size_t size;
+};
+
+static struct xc_handle *xc_handle_open(void)
+{
+	struct xc_handle *h = calloc(1, sizeof(*h));
+
+	if (!h)
+		return NULL;
+	h->xch = xc_interface_open(NULL, NULL, 0);
+	if (!h->xch) {
+		free(h);
+		return NULL;
 	}
-	caml_raise_with_string(*caml_named_value("xc.error"), error_str);
+	return h;
+}
+
+static void xc_handle_free(struct xc_handle *h)
+{
+	xc_interface_close(h->xch);
+	if (h->data) {
+		munlock(h->data, h->size);
+		free(h->data);
+	}
+	free(h);
+}
+
+/* Closes h, or leaves it to the holder of its buffer */
+static void xc_handle_close(struct xc_handle *h)
+{
+	if (__atomic_exchange_n(&h->state, HANDLE_CLOSING,
+	                        __ATOMIC_ACQ_REL) == HANDLE_IDLE)
+		xc_handle_free(h);
+}
+
+/* Grows b to hold at least size bytes, keeping its contents. Returns 0,
+ * or -1 with errno set. */
+static int xc_buffer_grow(struct xc_buffer *b, size_t size)
+{
+	void *data;
+
+	if (size <= b->size)
+		return 0;
+
+	if (!b->handle) {
+		data = realloc(b->data, size);
+		if (!data) {
+			errno = ENOMEM;
+			return -1;
+		}
+		b->data = data;
+		b->size = size;
+		return 0;
+	}
+
+	size = (size + PAGE_SIZE - 1) & PAGE_MASK;
+	if (posix_memalign(&data, PAGE_SIZE, size)) {
+		errno = ENOMEM;
+		return -1;
+	}
+	/* Best effort: RLIMIT_MEMLOCK may be too small, and the buffer
+	 * works as well unlocked */
+	mlock(data, size);
+	if (b->data) {
+		memcpy(data, b->data, b->size);
+		munlock(b->data, b->size);
+		free(b->data);
+	}
+	b->handle->data = b->data = data;
+	b->handle->size = b->size = size;
+	b->handle->grows++;
+	return 0;
+}
+
+static void xc_buffer_put(struct xc_buffer *b)
+{
+	int held = HANDLE_HELD;
+
+	if (!b->handle)
+		free(b->data);
+	else if (!__atomic_compare_exchange_n(&b->handle->state, &held,
+	                                      HANDLE_IDLE, 0, __ATOMIC_RELEASE,
+	                                      __ATOMIC_ACQUIRE))
+		/* Closed while we held it */
+		xc_handle_free(b->handle);
+	b->handle = NULL;
+	b->data = NULL;
+	b->size = 0;
+}
+
+/* Claims a buffer of at least size bytes: the buffer of h if h is not
+ * NULL and the buffer is free, else a malloc'd one. It must be released
+ * with xc_buffer_put on every path, including before raising. Returns 0,
+ * or -1 with errno set. */
+static int xc_buffer_get(struct xc_handle *h, struct xc_buffer *b,
+                         size_t size)
+{
+	int idle = HANDLE_IDLE;
+
+	b->handle = NULL;
+	b->data = NULL;
+	b->size = 0;
+	if (h && __atomic_compare_exchange_n(&h->state, &idle, HANDLE_HELD, 0,
+	                                     __ATOMIC_ACQUIRE,
+	                                     __ATOMIC_RELAXED)) {
+		b->handle = h;
+		b->data = h->data;
+		b->size = h->size;
+	}
+	if (xc_buffer_grow(b, size) < 0) {
+		int err = errno;
+
+		xc_buffer_put(b);
+		errno = err;
+		return -1;
+	}
+	return 0;
 }
 
 CAMLprim value stub_xc_interface_open(void)
 {
 	CAMLparam0();
-        xc_interface *xch;
+	CAMLlocal1(result);
+        struct xc_handle *h;
 
+	result = alloc_xc_handle();
 	/* Don't assert XC_OPENFLAG_NON_REENTRANT because these bindings
 	 * do not prevent re-entrancy to libxc */
-        xch = xc_interface_open(NULL, NULL, 0);
-        if (xch == NULL)
+        h = xc_handle_open();
+        if (h == NULL)
 		failwith_xc(NULL);
-        CAMLreturn((value)xch);
+	Handle_val(result) = h;
+        CAMLreturn(result);
 }
 
 
 CAMLprim value stub_xc_interface_close(value xch)
 {
 	CAMLparam1(xch);
+	struct xc_handle *h = Handle_val(xch);
+
+	XC_STAT_OP("interface_close");
+	xc_blocking_enter();
+	xc_handle_close(h);
+	xc_blocking_leave();
+
+	CAMLreturn(Val_unit);
+}
+
+CAMLprim value stub_xc_handle_buffer_grows(value xch)
+{
+	CAMLparam1(xch);
+	CAMLreturn(Val_int(Handle_val(xch)->grows));
+}
+
+/* A fixed set of slots, each holding a lazily opened handle. A slot is
+ * claimed with a compare-and-swap on its busy flag, so checkout and
+ * return need no lock and work from any thread. */
+struct handle_pool_slot {
+	struct xc_handle *h;
+	int busy;
+};
+
+struct handle_pool {
+	int nr_slots;
+	struct handle_pool_slot slots[];
+};
+
+#define Pool_val(v) (*((struct handle_pool **) Data_custom_val(v)))
+
+static void handle_pool_finalize(value v)
+{
+	struct handle_pool *pool = Pool_val(v);
+	int i;
+
+	/* A handle still checked out is in use by its holder, who now owns
+	 * it: closing it here would pull it from under a hypercall */
+	for (i = 0; i < pool->nr_slots; i++)
+		if (pool->slots[i].h &&
+		    !__atomic_load_n(&pool->slots[i].busy, __ATOMIC_ACQUIRE))
+			xc_handle_close(pool->slots[i].h);
+	free(pool);
+}
+
+static struct custom_operations handle_pool_ops = {
+	"xenctrl.handle_pool",
+	handle_pool_finalize,
+	custom_compare_default,
+	custom_hash_default,
+	custom_serialize_default,
+	custom_deserialize_default,
+	custom_compare_ext_default,
+};
+
+CAMLprim value stub_xc_handle_pool_create(value nr_slots)
+{
+	CAMLparam1(nr_slots);
+	CAMLlocal1(result);
+	struct handle_pool *pool;
+	int n = Int_val(nr_slots);
+
+	if (n < 1)
+		caml_invalid_argument("nr_slots");
+
+	pool = calloc(1, sizeof(*pool) + n * sizeof(pool->slots[0]));
+	if (!pool)
+		caml_raise_out_of_memory();
+	pool->nr_slots = n;
+
+	result = caml_alloc_custom(&handle_pool_ops, sizeof(pool), 0, 1);
+	Pool_val(result) = pool;
+	CAMLreturn(result);
+}
+
+CAMLprim value stub_xc_handle_pool_checkout(value p)
+{
+	CAMLparam1(p);
+	CAMLlocal1(result);
+	struct handle_pool *pool = Pool_val(p);
+	struct handle_pool_slot *slot = NULL;
+	struct xc_handle *h;
+	int i, idle;
+
+	XC_STAT_OP("handle_pool_checkout");
+	result = alloc_xc_handle();
+	for (i = 0; i < pool->nr_slots; i++) {
+		idle = 0;
+		if (__atomic_compare_exchange_n(&pool->slots[i].busy, &idle, 1, 0,
+		                                __ATOMIC_ACQUIRE,
+		                                __ATOMIC_RELAXED)) {
+			slot = &pool->slots[i];
+			break;
+		}
+	}
+
+	/* If every slot is in use, an unpooled handle is handed out, and
+	 * closed on return. Opening one opens the privcmd device, which
+	 * may block, so it is done without the runtime lock; the slot is
+	 * ours until then, and p keeps the pool alive. */
+	h = slot ? slot->h : NULL;
+	if (!h) {
+		xc_blocking_enter();
+		h = xc_handle_open();
+		xc_blocking_leave();
+		if (slot)
+			slot->h = h;
+	}
+	if (!h) {
+		if (slot)
+			__atomic_store_n(&slot->busy, 0, __ATOMIC_RELEASE);
+		failwith_xc(NULL);
+	}
+	Handle_val(result) = h;
+	CAMLreturn(result);
+}
+
+CAMLprim value stub_xc_handle_pool_return(value p, value xch)
+{
+	CAMLparam2(p, xch);
+	struct handle_pool *pool = Pool_val(p);
+	struct xc_handle *h = Handle_val(xch);
+	int i;
+
+	XC_STAT_OP("handle_pool_return");
+	for (i = 0; i < pool->nr_slots; i++) {
+		if (pool->slots[i].h == h) {
+			__atomic_store_n(&pool->slots[i].busy, 0, __ATOMIC_RELEASE);
+			CAMLreturn(Val_unit);
+		}
+	}
 
-	caml_enter_blocking_section();
-	xc_interface_close(_H(xch));
-	caml_leave_blocking_section();
+	xc_blocking_enter();
+	xc_handle_close(h);
+	xc_blocking_leave();
 
 	CAMLreturn(Val_unit);
 }
@@ -106,6 +658,7 @@ CAMLprim value stub_xc_domain_create(value xch, value ssidref,
                                      value flags, value handle)
 {
 	CAMLparam4(xch, ssidref, flags, handle);
+	xc_interface *c_xch = _H(xch);
 
 	uint32_t domid = 0;
 	xen_domain_handle_t h = { 0 };
@@ -115,6 +668,7 @@ CAMLprim value stub_xc_domain_create(value xch, value ssidref,
 	unsigned int c_flags = 0;
 	value l;
 
+	XC_STAT_OP("domain_create");
         if (Wosize_val(handle) != 16)
 		caml_invalid_argument("Handle not a 16-integer array");
 
@@ -127,16 +681,16 @@ CAMLprim value stub_xc_domain_create(value xch, value ssidref,
 		c_flags |= domain_create_flag_table[v];
 	}
 
-	caml_enter_blocking_section();
-	result = xc_domain_create(_H(xch), c_ssidref, h, c_flags, &domid
+	xc_blocking_enter();
+	result = xc_domain_create(c_xch, c_ssidref, h, c_flags, &domid
 #ifdef DOMAIN_CREATE_HAS_CONFIG
 		,NULL
 #endif
 		);
-	caml_leave_blocking_section();
+	xc_blocking_leave();
 
 	if (result < 0)
-		failwith_xc(_H(xch));
+		failwith_xc(c_xch);
 
 	CAMLreturn(Val_int(domid));
 }
@@ -145,11 +699,17 @@ CAMLprim value stub_xc_domain_max_vcpus(value xch, value domid,
                                         value max_vcpus)
 {
 	CAMLparam3(xch, domid, max_vcpus);
+	xc_interface *c_xch = _H(xch);
 	int r;
+	uint32_t c_domid = _D(domid);
+	unsigned int c_max_vcpus = Int_val(max_vcpus);
 
-	r = xc_domain_max_vcpus(_H(xch), _D(domid), Int_val(max_vcpus));
+	XC_STAT_OP("domain_max_vcpus");
+	xc_blocking_enter();
+	r = xc_domain_max_vcpus(c_xch, c_domid, c_max_vcpus);
+	xc_blocking_leave();
 	if (r)
-		failwith_xc(_H(xch));
+		failwith_xc(c_xch);
 
 	CAMLreturn(Val_unit);
 }
@@ -158,7 +718,9 @@ CAMLprim value stub_xc_domain_max_vcpus(value xch, value domid,
 value stub_xc_domain_sethandle(value xch, value domid, value handle)
 {
 	CAMLparam3(xch, domid, handle);
+	xc_interface *c_xch = _H(xch);
 	xen_domain_handle_t h = { 0 };
+	uint32_t c_domid = _D(domid);
 	int i;
 
         if (Wosize_val(handle) != 16)
@@ -168,9 +730,12 @@ value stub_xc_domain_sethandle(value xch, value domid, value handle)
 		h[i] = Int_val(Field(handle, i)) & 0xff;
 	}
 
-	i = xc_domain_sethandle(_H(xch), _D(domid), h);
+	XC_STAT_OP("domain_sethandle");
+	xc_blocking_enter();
+	i = xc_domain_sethandle(c_xch, c_domid, h);
+	xc_blocking_leave();
 	if (i)
-		failwith_xc(_H(xch));
+		failwith_xc(c_xch);
 
 	CAMLreturn(Val_unit);
 }
@@ -178,61 +743,203 @@ value stub_xc_domain_sethandle(value xch, value domid, value handle)
 static value dom_op(value xch, value domid, int (*fn)(xc_interface *, uint32_t))
 {
 	CAMLparam2(xch, domid);
+	xc_interface *c_xch = _H(xch);
 	int result;
 
 	uint32_t c_domid = _D(domid);
 
-	caml_enter_blocking_section();
-	result = fn(_H(xch), c_domid);
-	caml_leave_blocking_section();
+	xc_blocking_enter();
+	result = fn(c_xch, c_domid);
+	xc_blocking_leave();
         if (result)
-		failwith_xc(_H(xch));
+		failwith_xc(c_xch);
 	CAMLreturn(Val_unit);
 }
 
 CAMLprim value stub_xc_domain_pause(value xch, value domid)
 {
+	XC_STAT_OP("domain_pause");
 	return dom_op(xch, domid, xc_domain_pause);
 }
 
 
 CAMLprim value stub_xc_domain_unpause(value xch, value domid)
 {
+	XC_STAT_OP("domain_unpause");
 	return dom_op(xch, domid, xc_domain_unpause);
 }
 
 CAMLprim value stub_xc_domain_destroy(value xch, value domid)
 {
+	XC_STAT_OP("domain_destroy");
 	return dom_op(xch, domid, xc_domain_destroy);
 }
 
 CAMLprim value stub_xc_domain_resume_fast(value xch, value domid)
 {
 	CAMLparam2(xch, domid);
+	xc_interface *c_xch = _H(xch);
 	int result;
 
 	uint32_t c_domid = _D(domid);
 
-	caml_enter_blocking_section();
-	result = xc_domain_resume(_H(xch), c_domid, 1);
-	caml_leave_blocking_section();
+	XC_STAT_OP("domain_resume_fast");
+	xc_blocking_enter();
+	result = xc_domain_resume(c_xch, c_domid, 1);
+	xc_blocking_leave();
         if (result)
-		failwith_xc(_H(xch));
+		failwith_xc(c_xch);
 	CAMLreturn(Val_unit);
 }
 
 CAMLprim value stub_xc_domain_shutdown(value xch, value domid, value reason)
 {
 	CAMLparam3(xch, domid, reason);
+	xc_interface *c_xch = _H(xch);
 	int ret;
+	uint32_t c_domid = _D(domid);
+	int c_reason = Int_val(reason);
 
-	ret = xc_domain_shutdown(_H(xch), _D(domid), Int_val(reason));
+	XC_STAT_OP("domain_shutdown");
+	xc_blocking_enter();
+	ret = xc_domain_shutdown(c_xch, c_domid, c_reason);
+	xc_blocking_leave();
 	if (ret < 0)
-		failwith_xc(_H(xch));
+		failwith_xc(c_xch);
 
 	CAMLreturn(Val_unit);
 }
 
+/* Operations of stub_xc_domain_batch_op, in the order of the offsets
+ * passed by Xenctrl */
+enum {
+	BATCH_PAUSE,
+	BATCH_UNPAUSE,
+	BATCH_DESTROY,
+	BATCH_SHUTDOWN,
+};
+
+/* The op each operation is reported as, after its Xenctrl function */
+static struct xc_stat batch_stats[] = {
+	[BATCH_PAUSE] = { .name = "domain_pause_many" },
+	[BATCH_UNPAUSE] = { .name = "domain_unpause_many" },
+	[BATCH_DESTROY] = { .name = "domain_destroy_many" },
+	[BATCH_SHUTDOWN] = { .name = "domain_shutdown_many" },
+};
+
+struct batch_work {
+	int op;
+	int reason;
+	const uint32_t *domids;
+	int *results;
+	int nr;
+	int next;
+};
+
+static int batch_apply(struct batch_work *w, xc_interface *xch,
+                       uint32_t domid)
+{
+	int r;
+
+	switch (w->op) {
+	case BATCH_PAUSE:
+		r = xc_domain_pause(xch, domid);
+		break;
+	case BATCH_UNPAUSE:
+		r = xc_domain_unpause(xch, domid);
+		break;
+	case BATCH_DESTROY:
+		r = xc_domain_destroy(xch, domid);
+		break;
+	default:
+		r = xc_domain_shutdown(xch, domid, w->reason);
+		break;
+	}
+	if (r == 0)
+		return 0;
+	return errno ? errno : EINVAL;
+}
+
+/* Workers claim domains one at a time, so that a domain with a lot of
+ * memory to relinquish does not hold up the others */
+static void batch_run(struct batch_work *w, xc_interface *xch)
+{
+	int i;
+
+	while ((i = __atomic_fetch_add(&w->next, 1, __ATOMIC_RELAXED)) < w->nr)
+		w->results[i] = batch_apply(w, xch, w->domids[i]);
+}
+
+/* An xc_interface, and the last error it keeps, is not to be shared
+ * between threads, so each worker opens its own. A worker which cannot
+ * open one leaves its share of the domains to the others. */
+static void *batch_worker(void *arg)
+{
+	xc_interface *xch = xc_interface_open(NULL, NULL, 0);
+
+	if (xch) {
+		batch_run(arg, xch);
+		xc_interface_close(xch);
+	}
+	return NULL;
+}
+
+CAMLprim value stub_xc_domain_batch_op(value xch, value op, value reason,
+                                       value domids, value workers)
+{
+	CAMLparam5(xch, op, reason, domids, workers);
+	CAMLlocal1(result);
+	xc_interface *c_xch = _H(xch);
+	struct batch_work w;
+	pthread_t *threads = NULL;
+	uint32_t *c_domids;
+	int *results;
+	int nr = Wosize_val(domids);
+	int nr_threads = Int_val(workers) - 1, started = 0, i;
+
+	xc_stats_set_op(&batch_stats[Int_val(op)]);
+	c_domids = malloc((nr ? nr : 1) * sizeof(*c_domids));
+	results = malloc((nr ? nr : 1) * sizeof(*results));
+	if (nr_threads > nr - 1)
+		nr_threads = nr - 1;
+	if (nr_threads > 0)
+		threads = malloc(nr_threads * sizeof(*threads));
+	if (!c_domids || !results || (nr_threads > 0 && !threads)) {
+		free(c_domids);
+		free(results);
+		free(threads);
+		caml_raise_out_of_memory();
+	}
+	for (i = 0; i < nr; i++)
+		c_domids[i] = _D(Field(domids, i));
+
+	w.op = Int_val(op);
+	w.reason = Int_val(reason);
+	w.domids = c_domids;
+	w.results = results;
+	w.nr = nr;
+	w.next = 0;
+
+	xc_blocking_enter();
+	/* The calling thread works too, on the caller's handle, and
+	 * carries on alone if no thread can be started */
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_create(&threads[started], NULL, batch_worker, &w) == 0)
+			started++;
+	batch_run(&w, c_xch);
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	xc_blocking_leave();
+
+	result = caml_alloc(nr, 0);
+	for (i = 0; i < nr; i++)
+		Field(result, i) = Val_int(results[i]);
+	free(c_domids);
+	free(results);
+	free(threads);
+	CAMLreturn(result);
+}
+
 static value alloc_domaininfo(xc_domaininfo_t * info)
 {
 	CAMLparam0();
@@ -268,137 +975,989 @@ static value alloc_domaininfo(xc_domaininfo_t * info)
 	CAMLreturn(result);
 }
 
-CAMLprim value stub_xc_domain_getinfolist(value xch, value first_domain, value nb)
+/* Number of entries requested by the first getinfolist sysctl; the buffer
+ * doubles each time it fills, so large hosts need only a few sysctls. */
+#define GETINFOLIST_CHUNK 256
+
+/* Fetch info for every domain from first_domain upwards into b, an
+ * array of xc_domaininfo_t to be released with xc_buffer_put. b is the
+ * buffer of h, or a malloc'd one if h is NULL. Returns the number of
+ * entries, or -1 with errno set and b released. Does not touch the OCaml
+ * heap, so may run inside a blocking section. */
+static int domain_getinfolist_all(struct xc_handle *h, xc_interface *xch,
+                                  uint32_t first_domain, struct xc_buffer *b)
 {
-	CAMLparam3(xch, first_domain, nb);
-	CAMLlocal2(result, temp);
-	xc_domaininfo_t * info;
-	int i, ret, toalloc, retval;
-	unsigned int c_max_domains;
-	uint32_t c_first_domain;
-
-	/* get the minimum number of allocate byte we need and bump it up to page boundary */
-	toalloc = (sizeof(xc_domaininfo_t) * Int_val(nb)) | 0xfff;
-	ret = posix_memalign((void **) ((void *) &info), 4096, toalloc);
-	if (ret)
-		caml_raise_out_of_memory();
-
-	result = temp = Val_emptylist;
+	xc_domaininfo_t *info;
+	unsigned int nr = 0, size;
+	uint32_t next = first_domain;
+	int ret, err;
+
+	if (xc_buffer_get(h, b, GETINFOLIST_CHUNK * sizeof(*info)) < 0)
+		return -1;
+
+	for (;;) {
+		/* The buffer of a handle keeps its high-water mark, so this
+		 * is usually a single sysctl */
+		size = b->size / sizeof(*info);
+		if (nr == size) {
+			if (xc_buffer_grow(b, 2 * b->size) < 0)
+				goto fail;
+			size = b->size / sizeof(*info);
+		}
+		info = b->data;
 
-	c_first_domain = _D(first_domain);
-	c_max_domains = Int_val(nb);
-	caml_enter_blocking_section();
-	retval = xc_domain_getinfolist(_H(xch), c_first_domain,
-				       c_max_domains, info);
-	caml_leave_blocking_section();
+		ret = xc_domain_getinfolist(xch, next, size - nr, info + nr);
+		if (ret < 0)
+			goto fail;
+		nr += ret;
 
-	if (retval < 0) {
-		free(info);
-		failwith_xc(_H(xch));
+		/* A short read means we have seen the last domain */
+		if (nr < size)
+			break;
+		next = info[nr - 1].domain + 1;
 	}
-	for (i = 0; i < retval; i++) {
-		result = caml_alloc_small(2, Tag_cons);
-		Field(result, 0) = Val_int(0);
-		Field(result, 1) = temp;
-		temp = result;
 
-		Store_field(result, 0, alloc_domaininfo(info + i));
-	}
+	return nr;
 
-	free(info);
-	CAMLreturn(result);
+fail:
+	err = errno;
+	xc_buffer_put(b);
+	errno = err;
+	return -1;
 }
 
-CAMLprim value stub_xc_domain_getinfo(value xch, value domid)
+CAMLprim value stub_xc_domain_getinfolist(value xch, value first_domain)
 {
-	CAMLparam2(xch, domid);
+	CAMLparam2(xch, first_domain);
 	CAMLlocal1(result);
-	xc_domaininfo_t info;
-	int ret;
+	struct xc_handle *c_handle = Handle_val(xch);
+	xc_interface *c_xch = c_handle->xch;
+	struct xc_buffer b;
+	xc_domaininfo_t *info;
+	int i, nr;
+	uint32_t c_first_domain = _D(first_domain);
+
+	XC_STAT_OP("domain_getinfolist_array");
+	xc_blocking_enter();
+	nr = domain_getinfolist_all(c_handle, c_xch, c_first_domain,
+	                            &b);
+	xc_blocking_leave();
+
+	if (nr < 0)
+		failwith_xc(c_xch);
+
+	if (nr == 0) {
+		xc_buffer_put(&b);
+		CAMLreturn(Atom(0));
+	}
 
-	ret = xc_domain_getinfolist(_H(xch), _D(domid), 1, &info);
-	if (ret != 1)
-		failwith_xc(_H(xch));
-	if (info.domain != _D(domid))
-		failwith_xc(_H(xch));
+	info = b.data;
+	result = caml_alloc(nr, 0);
+	for (i = 0; i < nr; i++)
+		Store_field(result, i, alloc_domaininfo(info + i));
 
-	result = alloc_domaininfo(&info);
+	xc_buffer_put(&b);
 	CAMLreturn(result);
 }
 
-CAMLprim value stub_xc_vcpu_getinfo(value xch, value domid, value vcpu)
-{
-	CAMLparam3(xch, domid, vcpu);
-	CAMLlocal1(result);
-	xc_vcpuinfo_t info;
-	int retval;
+/* The previous getinfolist table, kept C-side so that successive polls
+ * can be diffed without going through OCaml records. The current table is
+ * copied into next, which then becomes info. */
+struct domain_tracker {
+	xc_domaininfo_t *info;
+	xc_domaininfo_t *next;
+	int nr;
+	int capacity;
+	intnat generation;
+};
 
-	uint32_t c_domid = _D(domid);
-	uint32_t c_vcpu = Int_val(vcpu);
-	caml_enter_blocking_section();
-	retval = xc_vcpu_getinfo(_H(xch), c_domid,
-	                         c_vcpu, &info);
-	caml_leave_blocking_section();
-	if (retval < 0)
-		failwith_xc(_H(xch));
+#define Tracker_val(v) (*((struct domain_tracker **) Data_custom_val(v)))
 
-	result = caml_alloc_tuple(5);
-	Store_field(result, 0, Val_bool(info.online));
-	Store_field(result, 1, Val_bool(info.blocked));
-	Store_field(result, 2, Val_bool(info.running));
-	Store_field(result, 3, caml_copy_int64(info.cpu_time));
-	Store_field(result, 4, caml_copy_int32(info.cpu));
+static void domain_tracker_finalize(value v)
+{
+	struct domain_tracker *t = Tracker_val(v);
 
-	CAMLreturn(result);
+	free(t->info);
+	free(t->next);
+	free(t);
 }
 
-CAMLprim value stub_xc_get_runstate_info(value xch, value domid)
+static struct custom_operations domain_tracker_ops = {
+	"xenctrl.domain_tracker",
+	domain_tracker_finalize,
+	custom_compare_default,
+	custom_hash_default,
+	custom_serialize_default,
+	custom_deserialize_default,
+	custom_compare_ext_default,
+};
+
+/* Constructors of Xenctrl.domain_change */
+#define CHANGE_CREATED   0
+#define CHANGE_DESTROYED 1
+#define CHANGE_CHANGED   2
+
+CAMLprim value stub_xc_domain_tracker_create(value unit)
 {
-#if defined(XENCTRL_HAS_GET_RUNSTATE_INFO)
-	CAMLparam2(xch, domid);
+	CAMLparam1(unit);
 	CAMLlocal1(result);
-	xc_runstate_info_t info;
-	int retval;
-
-	retval = xc_get_runstate_info(_H(xch), _D(domid), &info);
-	if (retval < 0)
-		failwith_xc(_H(xch));
+	struct domain_tracker *t;
 
-	/* Store
-	   0 : state (int32)
-	   1 : missed_changes (int32)
-	   2 : state_entry_time (int64)
-	   3-8 : times (int64s)
-	*/
-	result = caml_alloc_tuple(9);
-	Store_field(result, 0, caml_copy_int32(info.state));
-	Store_field(result, 1, caml_copy_int32(info.missed_changes));
-	Store_field(result, 2, caml_copy_int64(info.state_entry_time));
-	Store_field(result, 3, caml_copy_int64(info.time[0]));
-	Store_field(result, 4, caml_copy_int64(info.time[1]));
-	Store_field(result, 5, caml_copy_int64(info.time[2]));
-	Store_field(result, 6, caml_copy_int64(info.time[3]));
-	Store_field(result, 7, caml_copy_int64(info.time[4]));
-	Store_field(result, 8, caml_copy_int64(info.time[5]));
+	t = calloc(1, sizeof(*t));
+	if (!t)
+		caml_raise_out_of_memory();
 
+	result = caml_alloc_custom(&domain_tracker_ops, sizeof(t), 0, 1);
+	Tracker_val(result) = t;
 	CAMLreturn(result);
-#else
-	caml_failwith("XENCTRL_HAS_GET_RUNSTATE_INFO not defined");
-#endif
 }
 
-CAMLprim value stub_xc_vcpu_context_get(value xch, value domid,
-                                        value cpu)
+/* cpu_time, and hence the struct as a whole, changes on every poll of a
+ * running domain: only compare the fields that describe its state */
+static int domaininfo_changed(const xc_domaininfo_t *a,
+                              const xc_domaininfo_t *b)
 {
-	CAMLparam3(xch, domid, cpu);
-	CAMLlocal1(context);
-	int ret;
+	return a->flags != b->flags ||
+	       a->tot_pages != b->tot_pages ||
+	       a->max_pages != b->max_pages ||
+	       a->nr_online_vcpus != b->nr_online_vcpus ||
+	       a->max_vcpu_id != b->max_vcpu_id;
+}
+
+static value prepend_change(value list, int tag, value arg)
+{
+	CAMLparam2(list, arg);
+	CAMLlocal2(change, cell);
+
+	change = caml_alloc_small(1, tag);
+	Field(change, 0) = arg;
+
+	cell = caml_alloc_small(2, Tag_cons);
+	Field(cell, 0) = change;
+	Field(cell, 1) = list;
+
+	CAMLreturn(cell);
+}
+
+CAMLprim value stub_xc_domain_getinfo_changes(value xch, value tracker)
+{
+	CAMLparam2(xch, tracker);
+	CAMLlocal3(result, changes, tmp);
+	struct xc_handle *c_handle = Handle_val(xch);
+	xc_interface *c_xch = c_handle->xch;
+	struct domain_tracker *t = Tracker_val(tracker);
+	const xc_domaininfo_t *old, *cur;
+	xc_domaininfo_t *info, *tmp_info;
+	struct xc_buffer b;
+	int i, j, nr;
+
+	XC_STAT_OP("domain_getinfo_changes");
+	xc_blocking_enter();
+	nr = domain_getinfolist_all(c_handle, c_xch, 0, &b);
+	xc_blocking_leave();
+
+	if (nr < 0)
+		failwith_xc(c_xch);
+
+	/* Make room to keep this table before anything can raise */
+	if (nr > t->capacity) {
+		tmp_info = realloc(t->info, nr * sizeof(*t->info));
+		if (tmp_info)
+			t->info = tmp_info;
+		tmp_info = tmp_info ? realloc(t->next, nr * sizeof(*t->next)) : NULL;
+		if (!tmp_info) {
+			xc_buffer_put(&b);
+			caml_raise_out_of_memory();
+		}
+		t->next = tmp_info;
+		t->capacity = nr;
+	}
+
+	/* The records below are built from our copy, after the handle's
+	 * buffer has been released */
+	info = t->next;
+	if (nr)
+		memcpy(info, b.data, nr * sizeof(*info));
+	xc_buffer_put(&b);
+
+	/* Both tables are sorted by domid: merge them from the end so that
+	 * the resulting list is in increasing domid order */
+	changes = Val_emptylist;
+	i = t->nr - 1;
+	j = nr - 1;
+	while (i >= 0 || j >= 0) {
+		old = (i >= 0) ? &t->info[i] : NULL;
+		cur = (j >= 0) ? &info[j] : NULL;
+
+		if (cur && (!old || cur->domain > old->domain)) {
+			tmp = alloc_domaininfo((xc_domaininfo_t *) cur);
+			changes = prepend_change(changes, CHANGE_CREATED, tmp);
+			j--;
+		} else if (!cur || old->domain > cur->domain) {
+			changes = prepend_change(changes, CHANGE_DESTROYED,
+			                         Val_int(old->domain));
+			i--;
+		} else {
+			/* A different handle means the domid was reused */
+			if (memcmp(old->handle, cur->handle, sizeof(old->handle))) {
+				tmp = alloc_domaininfo((xc_domaininfo_t *) cur);
+				changes = prepend_change(changes, CHANGE_CREATED, tmp);
+				changes = prepend_change(changes, CHANGE_DESTROYED,
+				                         Val_int(old->domain));
+			} else if (domaininfo_changed(old, cur)) {
+				tmp = alloc_domaininfo((xc_domaininfo_t *) cur);
+				changes = prepend_change(changes, CHANGE_CHANGED, tmp);
+			}
+			i--;
+			j--;
+		}
+	}
+
+	t->next = t->info;
+	t->info = info;
+	t->nr = nr;
+	if (changes != Val_emptylist)
+		t->generation++;
+
+	result = caml_alloc_tuple(2);
+	Store_field(result, 0, Val_long(t->generation));
+	Store_field(result, 1, changes);
+
+	CAMLreturn(result);
+}
+
+/* An event channel bound to VIRQ_DOM_EXC, which Xen raises whenever a
+ * domain shuts down or dies */
+struct virq_watch {
+	xc_evtchn *xce;
+	evtchn_port_t port;
+};
+
+#define Virq_val(v) (*((struct virq_watch **) Data_custom_val(v)))
+
+static void virq_watch_close(struct virq_watch *w)
+{
+	if (w->xce) {
+		xc_evtchn_unbind(w->xce, w->port);
+		xc_evtchn_close(w->xce);
+		w->xce = NULL;
+	}
+}
+
+static void virq_watch_finalize(value v)
+{
+	struct virq_watch *w = Virq_val(v);
+
+	virq_watch_close(w);
+	free(w);
+}
+
+static struct custom_operations virq_watch_ops = {
+	"xenctrl.virq_watch",
+	virq_watch_finalize,
+	custom_compare_default,
+	custom_hash_default,
+	custom_serialize_default,
+	custom_deserialize_default,
+	custom_compare_ext_default,
+};
+
+CAMLprim value stub_xc_virq_dom_exc_bind(value unit)
+{
+	CAMLparam1(unit);
+	CAMLlocal1(result);
+	struct virq_watch *w;
+	evtchn_port_or_error_t port;
+	int fd;
+
+	w = calloc(1, sizeof(*w));
+	if (!w)
+		caml_raise_out_of_memory();
+
+	w->xce = xc_evtchn_open(NULL, 0);
+	if (!w->xce) {
+		free(w);
+		caml_failwith("xc_evtchn_open");
+	}
+
+	port = xc_evtchn_bind_virq(w->xce, VIRQ_DOM_EXC);
+	if (port < 0) {
+		xc_evtchn_close(w->xce);
+		free(w);
+		caml_failwith("xc_evtchn_bind_virq");
+	}
+	w->port = port;
+
+	/* Draining must never block: the caller polls the fd instead */
+	fd = xc_evtchn_fd(w->xce);
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+	result = caml_alloc_custom(&virq_watch_ops, sizeof(w), 0, 1);
+	Virq_val(result) = w;
+	CAMLreturn(result);
+}
+
+CAMLprim value stub_xc_virq_fd(value watch)
+{
+	CAMLparam1(watch);
+	struct virq_watch *w = Virq_val(watch);
+
+	if (!w->xce)
+		caml_invalid_argument("virq watch closed");
+	CAMLreturn(Val_int(xc_evtchn_fd(w->xce)));
+}
+
+CAMLprim value stub_xc_virq_drain(value watch)
+{
+	CAMLparam1(watch);
+	struct virq_watch *w = Virq_val(watch);
+	evtchn_port_or_error_t port;
+	int fired = 0;
+
+	if (!w->xce)
+		caml_invalid_argument("virq watch closed");
+
+	while ((port = xc_evtchn_pending(w->xce)) >= 0) {
+		xc_evtchn_unmask(w->xce, port);
+		fired = 1;
+	}
+	if (errno != EAGAIN)
+		caml_failwith("xc_evtchn_pending");
+
+	CAMLreturn(Val_bool(fired));
+}
+
+CAMLprim value stub_xc_virq_close(value watch)
+{
+	CAMLparam1(watch);
+
+	virq_watch_close(Virq_val(watch));
+	CAMLreturn(Val_unit);
+}
+
+/* Field layout of Xenctrl.domaininfo_snapshot */
+enum {
+	SNAP_DOMID,
+	SNAP_FLAGS,
+	SNAP_TOT_PAGES,
+	SNAP_MAX_PAGES,
+	SNAP_SHARED_INFO_FRAME,
+	SNAP_CPU_TIME,
+	SNAP_NR_ONLINE_VCPUS,
+	SNAP_MAX_VCPU_ID,
+	SNAP_SSIDREF,
+	SNAP_HANDLE,
+	SNAP_RAW,
+	SNAP_NR_FIELDS
+};
+
+static const int snapshot_column_kind[SNAP_HANDLE] = {
+	[SNAP_DOMID]             = CAML_BA_INT32,
+	[SNAP_FLAGS]             = CAML_BA_INT32,
+	[SNAP_TOT_PAGES]         = CAML_BA_INT64,
+	[SNAP_MAX_PAGES]         = CAML_BA_INT64,
+	[SNAP_SHARED_INFO_FRAME] = CAML_BA_INT64,
+	[SNAP_CPU_TIME]          = CAML_BA_INT64,
+	[SNAP_NR_ONLINE_VCPUS]   = CAML_BA_INT32,
+	[SNAP_MAX_VCPU_ID]       = CAML_BA_INT32,
+	[SNAP_SSIDREF]           = CAML_BA_INT32,
+};
+
+#define Snap_col(snap, f, type) ((type *) Caml_ba_data_val(Field(snap, f)))
+
+CAMLprim value stub_xc_domaininfo_snapshot_create(value capacity)
+{
+	CAMLparam1(capacity);
+	CAMLlocal2(result, col);
+	intnat n = Int_val(capacity);
+	int i;
+
+	if (n < 1)
+		caml_invalid_argument("capacity");
+
+	result = caml_alloc_tuple(SNAP_NR_FIELDS);
+	for (i = 0; i < SNAP_HANDLE; i++) {
+		col = caml_ba_alloc_dims(snapshot_column_kind[i] | CAML_BA_C_LAYOUT,
+		                         1, NULL, n);
+		Store_field(result, i, col);
+	}
+
+	col = caml_ba_alloc_dims(CAML_BA_UINT8 | CAML_BA_C_LAYOUT, 2, NULL,
+	                         n, (intnat) sizeof(xen_domain_handle_t));
+	Store_field(result, SNAP_HANDLE, col);
+
+	/* The hypercall buffer: raw xc_domaininfo_t entries, reused by
+	 * every poll into this snapshot */
+	col = caml_ba_alloc_dims(CAML_BA_CHAR | CAML_BA_C_LAYOUT, 1, NULL,
+	                         n * (intnat) sizeof(xc_domaininfo_t));
+	Store_field(result, SNAP_RAW, col);
+
+	CAMLreturn(result);
+}
+
+CAMLprim value stub_xc_domain_getinfolist_snapshot(value xch,
+                                                   value first_domain,
+                                                   value snap)
+{
+	CAMLparam3(xch, first_domain, snap);
+	xc_interface *c_xch = _H(xch);
+	struct caml_ba_array *raw = Caml_ba_array_val(Field(snap, SNAP_RAW));
+	xc_domaininfo_t *info = raw->data;
+	unsigned int max = raw->dim[0] / sizeof(xc_domaininfo_t);
+	uint32_t c_first_domain = _D(first_domain);
+	uint8_t *handle;
+	int i, nr;
+
+	XC_STAT_OP("domain_getinfolist_snapshot");
+	xc_blocking_enter();
+	nr = xc_domain_getinfolist(c_xch, c_first_domain, max, info);
+	xc_blocking_leave();
+
+	if (nr < 0)
+		failwith_xc(c_xch);
+
+	handle = Snap_col(snap, SNAP_HANDLE, uint8_t);
+	for (i = 0; i < nr; i++) {
+		Snap_col(snap, SNAP_DOMID, int32_t)[i] = info[i].domain;
+		Snap_col(snap, SNAP_FLAGS, int32_t)[i] = info[i].flags;
+		Snap_col(snap, SNAP_TOT_PAGES, int64_t)[i] = info[i].tot_pages;
+		Snap_col(snap, SNAP_MAX_PAGES, int64_t)[i] = info[i].max_pages;
+		Snap_col(snap, SNAP_SHARED_INFO_FRAME, int64_t)[i] =
+			info[i].shared_info_frame;
+		Snap_col(snap, SNAP_CPU_TIME, int64_t)[i] = info[i].cpu_time;
+		Snap_col(snap, SNAP_NR_ONLINE_VCPUS, int32_t)[i] =
+			info[i].nr_online_vcpus;
+		Snap_col(snap, SNAP_MAX_VCPU_ID, int32_t)[i] = info[i].max_vcpu_id;
+		Snap_col(snap, SNAP_SSIDREF, int32_t)[i] = info[i].ssidref;
+		memcpy(handle + i * sizeof(xen_domain_handle_t), info[i].handle,
+		       sizeof(xen_domain_handle_t));
+	}
+
+	CAMLreturn(Val_int(nr));
+}
+
+CAMLprim value stub_xc_domain_getinfo(value xch, value domid)
+{
+	CAMLparam2(xch, domid);
+	CAMLlocal1(result);
+	xc_interface *c_xch = _H(xch);
+	xc_domaininfo_t info;
+	int ret;
+	uint32_t c_domid = _D(domid);
+
+	XC_STAT_OP("domain_getinfo");
+	xc_blocking_enter();
+	ret = xc_domain_getinfolist(c_xch, c_domid, 1, &info);
+	xc_blocking_leave();
+	if (ret != 1)
+		failwith_xc(c_xch);
+	if (info.domain != c_domid)
+		failwith_xc(c_xch);
+
+	result = alloc_domaininfo(&info);
+	CAMLreturn(result);
+}
+
+static value alloc_vcpuinfo(xc_vcpuinfo_t *info)
+{
+	CAMLparam0();
+	CAMLlocal1(result);
+
+	result = caml_alloc_tuple(5);
+	Store_field(result, 0, Val_bool(info->online));
+	Store_field(result, 1, Val_bool(info->blocked));
+	Store_field(result, 2, Val_bool(info->running));
+	Store_field(result, 3, caml_copy_int64(info->cpu_time));
+	Store_field(result, 4, caml_copy_int32(info->cpu));
+	CAMLreturn(result);
+}
+
+CAMLprim value stub_xc_vcpu_getinfo(value xch, value domid, value vcpu)
+{
+	CAMLparam3(xch, domid, vcpu);
+	xc_interface *c_xch = _H(xch);
+	xc_vcpuinfo_t info;
+	int retval;
+
+	uint32_t c_domid = _D(domid);
+	uint32_t c_vcpu = Int_val(vcpu);
+	XC_STAT_OP("domain_get_vcpuinfo");
+	xc_blocking_enter();
+	retval = xc_vcpu_getinfo(c_xch, c_domid,
+	                         c_vcpu, &info);
+	xc_blocking_leave();
+	if (retval < 0)
+		failwith_xc(c_xch);
+
+	CAMLreturn(alloc_vcpuinfo(&info));
+}
+
+/*
+ * Variants of the common queries which return a Xenctrl.call_result
+ * instead of raising. The error is only the errno and libxc error code:
+ * the message is formatted by stub_xc_call_error_message if asked for.
+ */
+static value alloc_call_ok(value v)
+{
+	CAMLparam1(v);
+	CAMLlocal1(result);
+
+	result = caml_alloc_small(1, 0);
+	Field(result, 0) = v;
+	CAMLreturn(result);
+}
+
+static value alloc_call_error(int err, int code)
+{
+	CAMLparam0();
+	CAMLlocal2(error, result);
+
+	xc_stats_error();
+
+	error = caml_alloc_small(2, 0);
+	Field(error, 0) = Val_int(err);
+	Field(error, 1) = Val_int(code);
+	result = caml_alloc_small(1, 1);
+	Field(result, 0) = error;
+	CAMLreturn(result);
+}
+
+#define alloc_call_error_xc(xch, err) \
+	alloc_call_error((err), xc_get_last_error(xch)->code)
+
+CAMLprim value stub_xc_call_error_message(value error)
+{
+	CAMLparam1(error);
+	char error_str[ERROR_STRLEN];
+	int err = Int_val(Field(error, 0));
+	int code = Int_val(Field(error, 1));
+
+	if (code == XC_ERROR_NONE)
+		snprintf(error_str, ERROR_STRLEN, "%d: %s", err, strerror(err));
+	else
+		snprintf(error_str, ERROR_STRLEN, "%d: %s", code,
+			 xc_error_code_to_desc(code));
+	CAMLreturn(caml_copy_string(error_str));
+}
+
+CAMLprim value stub_xc_domain_exists(value xch, value domid)
+{
+	CAMLparam2(xch, domid);
+	xc_interface *c_xch = _H(xch);
+	xc_domaininfo_t info;
+	uint32_t c_domid = _D(domid);
+	int ret;
+
+	XC_STAT_OP("domain_exists");
+	xc_blocking_enter();
+	ret = xc_domain_getinfolist(c_xch, c_domid, 1, &info);
+	xc_blocking_leave();
+
+	if (ret < 0 && errno != ESRCH)
+		failwith_xc(c_xch);
+	CAMLreturn(Val_bool(ret == 1 && info.domain == c_domid));
+}
+
+CAMLprim value stub_xc_domain_getinfo_result(value xch, value domid)
+{
+	CAMLparam2(xch, domid);
+	xc_interface *c_xch = _H(xch);
+	xc_domaininfo_t info;
+	uint32_t c_domid = _D(domid);
+	int ret, err;
+
+	XC_STAT_OP("domain_getinfo_result");
+	xc_blocking_enter();
+	ret = xc_domain_getinfolist(c_xch, c_domid, 1, &info);
+	err = errno;
+	xc_blocking_leave();
+
+	if (ret < 0)
+		CAMLreturn(alloc_call_error_xc(c_xch, err));
+	if (ret != 1 || info.domain != c_domid)
+		CAMLreturn(alloc_call_error(ESRCH, XC_ERROR_NONE));
+	CAMLreturn(alloc_call_ok(alloc_domaininfo(&info)));
+}
+
+CAMLprim value stub_xc_domain_getinfolist_result(value xch, value first_domain)
+{
+	CAMLparam2(xch, first_domain);
+	CAMLlocal1(result);
+	struct xc_handle *c_handle = Handle_val(xch);
+	xc_interface *c_xch = c_handle->xch;
+	struct xc_buffer b;
+	xc_domaininfo_t *info;
+	int i, nr, err;
+	uint32_t c_first_domain = _D(first_domain);
+
+	XC_STAT_OP("domain_getinfolist_result");
+	xc_blocking_enter();
+	nr = domain_getinfolist_all(c_handle, c_xch, c_first_domain,
+	                            &b);
+	err = errno;
+	xc_blocking_leave();
+
+	if (nr < 0)
+		CAMLreturn(alloc_call_error_xc(c_xch, err));
+
+	info = b.data;
+	if (nr == 0)
+		result = Atom(0);
+	else {
+		result = caml_alloc(nr, 0);
+		for (i = 0; i < nr; i++)
+			Store_field(result, i, alloc_domaininfo(info + i));
+	}
+	xc_buffer_put(&b);
+	CAMLreturn(alloc_call_ok(result));
+}
+
+CAMLprim value stub_xc_vcpu_getinfo_result(value xch, value domid,
+                                           value vcpu)
+{
+	CAMLparam3(xch, domid, vcpu);
+	xc_interface *c_xch = _H(xch);
+	xc_vcpuinfo_t info;
+	int retval, err;
+
+	XC_STAT_OP("domain_get_vcpuinfo_result");
+	xc_blocking_enter();
+	retval = xc_vcpu_getinfo(c_xch, _D(domid), Int_val(vcpu), &info);
+	err = errno;
+	xc_blocking_leave();
+
+	if (retval < 0)
+		CAMLreturn(alloc_call_error_xc(c_xch, err));
+	CAMLreturn(alloc_call_ok(alloc_vcpuinfo(&info)));
+}
+
+/* Columns of the matrix returned by the all_vcpuinfo stubs, one row per
+ * vcpu. Keep in sync with the vcpuinfo_col_* values in xenctrl.ml */
+enum {
+	VCPU_COL_DOMID,
+	VCPU_COL_VCPU,
+	VCPU_COL_ONLINE,
+	VCPU_COL_BLOCKED,
+	VCPU_COL_RUNNING,
+	VCPU_COL_CPU_TIME,
+	VCPU_COL_CPU,
+	VCPU_NR_COLS
+};
+
+/* Fill one row per vcpu of every domain in doms into a malloc'd matrix.
+ * If skip_vanished is set, domains destroyed in the meantime are left
+ * out instead of failing the whole call. Does not touch the OCaml heap.
+ * Returns NULL with errno set on failure. */
+static int64_t *all_vcpuinfo(xc_interface *xch, const xc_domaininfo_t *doms,
+                             int nr_doms, int skip_vanished, int *nr_rows)
+{
+	xc_vcpuinfo_t info;
+	int64_t *rows, *row;
+	size_t total = 0;
+	int i, n = 0, start;
+	uint32_t v;
+
+	for (i = 0; i < nr_doms; i++)
+		total += doms[i].max_vcpu_id + 1;
+
+	rows = malloc((total ? total : 1) * VCPU_NR_COLS * sizeof(int64_t));
+	if (!rows) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	for (i = 0; i < nr_doms; i++) {
+		start = n;
+		for (v = 0; v <= doms[i].max_vcpu_id; v++) {
+			if (xc_vcpu_getinfo(xch, doms[i].domain, v, &info) < 0)
+				break;
+			row = rows + (size_t) n++ * VCPU_NR_COLS;
+			row[VCPU_COL_DOMID]    = doms[i].domain;
+			row[VCPU_COL_VCPU]     = v;
+			row[VCPU_COL_ONLINE]   = info.online;
+			row[VCPU_COL_BLOCKED]  = info.blocked;
+			row[VCPU_COL_RUNNING]  = info.running;
+			row[VCPU_COL_CPU_TIME] = info.cpu_time;
+			row[VCPU_COL_CPU]      = info.cpu;
+		}
+		if (v <= doms[i].max_vcpu_id) {
+			if (!skip_vanished || errno != ESRCH) {
+				free(rows);
+				return NULL;
+			}
+			n = start;
+		}
+	}
+
+	*nr_rows = n;
+	return rows;
+}
+
+static value alloc_vcpuinfo_matrix(int64_t *rows, int nr_rows)
+{
+	/* The bigarray takes ownership of rows */
+	return caml_ba_alloc_dims(CAML_BA_INT64 | CAML_BA_C_LAYOUT | CAML_BA_MANAGED,
+	                          2, rows, (intnat) nr_rows, (intnat) VCPU_NR_COLS);
+}
+
+CAMLprim value stub_xc_domain_get_all_vcpuinfo(value xch, value domid)
+{
+	CAMLparam2(xch, domid);
+	xc_interface *c_xch = _H(xch);
+	xc_domaininfo_t dom;
+	uint32_t c_domid = _D(domid);
+	int64_t *rows = NULL;
+	int ret, nr_rows;
+
+	XC_STAT_OP("domain_get_all_vcpuinfo");
+	xc_blocking_enter();
+	ret = xc_domain_getinfolist(c_xch, c_domid, 1, &dom);
+	if (ret == 1 && dom.domain == c_domid)
+		rows = all_vcpuinfo(c_xch, &dom, 1, 0, &nr_rows);
+	else if (ret >= 0) {
+		/* The sysctl worked but returned some other domain, or none:
+		 * libxc has nothing to report, so the error is ours */
+		xc_clear_last_error(c_xch);
+		errno = ESRCH;
+	}
+	xc_blocking_leave();
+
+	if (!rows)
+		failwith_xc(c_xch);
+
+	CAMLreturn(alloc_vcpuinfo_matrix(rows, nr_rows));
+}
+
+CAMLprim value stub_xc_all_domains_get_vcpuinfo(value xch)
+{
+	CAMLparam1(xch);
+	struct xc_handle *c_handle = Handle_val(xch);
+	xc_interface *c_xch = c_handle->xch;
+	struct xc_buffer b;
+	int64_t *rows = NULL;
+	int nr_doms, nr_rows;
+
+	XC_STAT_OP("all_domains_get_vcpuinfo");
+	xc_blocking_enter();
+	nr_doms = domain_getinfolist_all(c_handle, c_xch, 0, &b);
+	if (nr_doms >= 0) {
+		rows = all_vcpuinfo(c_xch, b.data, nr_doms, 1, &nr_rows);
+		xc_buffer_put(&b);
+	}
+	xc_blocking_leave();
+
+	if (!rows)
+		failwith_xc(c_xch);
+
+	CAMLreturn(alloc_vcpuinfo_matrix(rows, nr_rows));
+}
+
+CAMLprim value stub_xc_get_runstate_info(value xch, value domid)
+{
+#if defined(XENCTRL_HAS_GET_RUNSTATE_INFO)
+	CAMLparam2(xch, domid);
+	CAMLlocal1(result);
+	xc_interface *c_xch = _H(xch);
+	xc_runstate_info_t info;
+	int retval;
+	uint32_t c_domid = _D(domid);
+
+	XC_STAT_OP("domain_get_runstate_info");
+	xc_blocking_enter();
+	retval = xc_get_runstate_info(c_xch, c_domid, &info);
+	xc_blocking_leave();
+	if (retval < 0)
+		failwith_xc(c_xch);
+
+	/* Store
+	   0 : state (int32)
+	   1 : missed_changes (int32)
+	   2 : state_entry_time (int64)
+	   3-8 : times (int64s)
+	*/
+	result = caml_alloc_tuple(9);
+	Store_field(result, 0, caml_copy_int32(info.state));
+	Store_field(result, 1, caml_copy_int32(info.missed_changes));
+	Store_field(result, 2, caml_copy_int64(info.state_entry_time));
+	Store_field(result, 3, caml_copy_int64(info.time[0]));
+	Store_field(result, 4, caml_copy_int64(info.time[1]));
+	Store_field(result, 5, caml_copy_int64(info.time[2]));
+	Store_field(result, 6, caml_copy_int64(info.time[3]));
+	Store_field(result, 7, caml_copy_int64(info.time[4]));
+	Store_field(result, 8, caml_copy_int64(info.time[5]));
+
+	CAMLreturn(result);
+#else
+	caml_failwith("XENCTRL_HAS_GET_RUNSTATE_INFO not defined");
+#endif
+}
+
+/* Columns of the matrix filled by stub_xc_runstate_sample, one row per
+ * domain. Keep in sync with the runstate_col_* values in xenctrl.ml */
+enum {
+	RS_COL_DOMID,
+	RS_COL_STATE,
+	RS_COL_MISSED_CHANGES,
+	RS_COL_STATE_ENTRY_TIME,
+	RS_COL_TIME0,
+	RS_NR_COLS = RS_COL_TIME0 + 6
+};
+
+/* Runstate times of every domain seen by the previous sample, sorted by
+ * domid, to compute per-interval deltas */
+struct runstate_prev {
+	uint32_t domid;
+	uint64_t time[6];
+};
+
+struct runstate_sampler {
+	struct runstate_prev *prev;
+	int nr;
+};
+
+#define Sampler_val(v) (*((struct runstate_sampler **) Data_custom_val(v)))
+
+static void runstate_sampler_finalize(value v)
+{
+	struct runstate_sampler *s = Sampler_val(v);
+
+	free(s->prev);
+	free(s);
+}
+
+static struct custom_operations runstate_sampler_ops = {
+	"xenctrl.runstate_sampler",
+	runstate_sampler_finalize,
+	custom_compare_default,
+	custom_hash_default,
+	custom_serialize_default,
+	custom_deserialize_default,
+	custom_compare_ext_default,
+};
+
+CAMLprim value stub_xc_runstate_sampler_create(value unit)
+{
+	CAMLparam1(unit);
+	CAMLlocal1(result);
+	struct runstate_sampler *s;
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		caml_raise_out_of_memory();
+
+	result = caml_alloc_custom(&runstate_sampler_ops, sizeof(s), 0, 1);
+	Sampler_val(result) = s;
+	CAMLreturn(result);
+}
+
+CAMLprim value stub_xc_runstate_sample(value xch, value sampler,
+                                       value deltas, value matrix)
+{
+#if defined(XENCTRL_HAS_GET_RUNSTATE_INFO)
+	CAMLparam4(xch, sampler, deltas, matrix);
+	struct xc_handle *c_handle = Handle_val(xch);
+	xc_interface *c_xch = c_handle->xch;
+	struct runstate_sampler *s = Sampler_val(sampler);
+	struct caml_ba_array *ba = Caml_ba_array_val(matrix);
+	struct runstate_prev *cur = NULL;
+	struct xc_buffer b = { NULL, NULL, 0 };
+	xc_domaininfo_t *doms = NULL;
+	xc_runstate_info_t info;
+	int64_t *row;
+	int c_deltas = Bool_val(deltas);
+	int nr_doms, i, j = 0, k, n = 0, err = 0;
+
+	XC_STAT_OP("runstate_sample");
+	if (ba->num_dims != 2 || ba->dim[1] != RS_NR_COLS)
+		caml_invalid_argument("runstate matrix");
+
+	/* The bigarray data lives outside the OCaml heap and is kept alive by
+	 * matrix, so it can be filled without the runtime lock */
+	xc_blocking_enter();
+	nr_doms = domain_getinfolist_all(c_handle, c_xch, 0, &b);
+	doms = b.data;
+	if (nr_doms < 0)
+		err = 1;
+	else if (!(cur = malloc((nr_doms ? nr_doms : 1) * sizeof(*cur)))) {
+		errno = ENOMEM;
+		err = 1;
+	}
+
+	/* Domains which do not fit in the matrix are still sampled, so that
+	 * the caller can grow it and the next sample has their deltas */
+	for (i = 0; !err && i < nr_doms; i++) {
+		if (xc_get_runstate_info(c_xch, doms[i].domain, &info) < 0) {
+			if (errno == ESRCH)
+				continue;
+			err = 1;
+			break;
+		}
+
+		while (j < s->nr && s->prev[j].domid < doms[i].domain)
+			j++;
+
+		cur[n].domid = doms[i].domain;
+		for (k = 0; k < 6; k++)
+			cur[n].time[k] = info.time[k];
+		if (n >= ba->dim[0]) {
+			n++;
+			continue;
+		}
+
+		row = (int64_t *) ba->data + (size_t) n * RS_NR_COLS;
+		row[RS_COL_DOMID] = doms[i].domain;
+		row[RS_COL_STATE] = info.state;
+		row[RS_COL_MISSED_CHANGES] = info.missed_changes;
+		row[RS_COL_STATE_ENTRY_TIME] = info.state_entry_time;
+
+		for (k = 0; k < 6; k++) {
+			row[RS_COL_TIME0 + k] = info.time[k];
+			/* A time going backwards means the domid was reused */
+			if (c_deltas && j < s->nr &&
+			    s->prev[j].domid == doms[i].domain &&
+			    info.time[k] >= s->prev[j].time[k])
+				row[RS_COL_TIME0 + k] -= s->prev[j].time[k];
+		}
+		n++;
+	}
+
+	xc_buffer_put(&b);
+	if (err)
+		free(cur);
+	else {
+		free(s->prev);
+		s->prev = cur;
+		s->nr = n;
+	}
+	xc_blocking_leave();
+
+	if (err)
+		failwith_xc(c_xch);
+
+	CAMLreturn(Val_int(n));
+#else
+	caml_failwith("XENCTRL_HAS_GET_RUNSTATE_INFO not defined");
+#endif
+}
+
+CAMLprim value stub_xc_vcpu_context_get(value xch, value domid,
+                                        value cpu)
+{
+	CAMLparam3(xch, domid, cpu);
+	CAMLlocal1(context);
+	xc_interface *c_xch = _H(xch);
+	int ret;
 	vcpu_guest_context_any_t ctxt;
+	uint32_t c_domid = _D(domid);
+	uint32_t c_cpu = Int_val(cpu);
 
-	ret = xc_vcpu_getcontext(_H(xch), _D(domid), Int_val(cpu), &ctxt);
+	XC_STAT_OP("vcpu_context_get");
+	xc_blocking_enter();
+	ret = xc_vcpu_getcontext(c_xch, c_domid, c_cpu, &ctxt);
+	xc_blocking_leave();
 
 	if (ret < 0)
-		failwith_xc(_H(xch));
+		failwith_xc(c_xch);
 
 	context = caml_alloc_string(sizeof(ctxt));
 	memcpy(String_val(context), (char *) &ctxt.c, sizeof(ctxt.c));
@@ -406,10 +1965,10 @@ CAMLprim value stub_xc_vcpu_context_get(value xch, value domid,
 	CAMLreturn(context);
 }
 
-static int get_cpumap_len(value xch, value cpumap)
+static int get_cpumap_len(xc_interface *xch, value cpumap)
 {
 	int ml_len = Wosize_val(cpumap);
-	int xc_len = xc_get_max_cpus(_H(xch));
+	int xc_len = xc_get_max_cpus(xch);
 
 	if (ml_len < xc_len)
 		return ml_len;
@@ -417,34 +1976,59 @@ static int get_cpumap_len(value xch, value cpumap)
 		return xc_len;
 }
 
+static int vcpu_setaffinity(xc_interface *xch, uint32_t domid, int vcpu,
+                            xc_cpumap_t cpumap)
+{
+	return xc_vcpu_setaffinity(xch, domid, vcpu,
+#ifdef HAVE_XEN_4_5
+	                           cpumap, cpumap, 0
+#else
+	                           cpumap
+#endif
+	                           );
+}
+
+static int vcpu_getaffinity(xc_interface *xch, uint32_t domid, int vcpu,
+                            xc_cpumap_t cpumap)
+{
+	return xc_vcpu_getaffinity(xch, domid, vcpu,
+#ifdef HAVE_XEN_4_5
+	                           cpumap, NULL, 0
+#else
+	                           cpumap
+#endif
+	                           );
+}
+
 CAMLprim value stub_xc_vcpu_setaffinity(value xch, value domid,
                                         value vcpu, value cpumap)
 {
 	CAMLparam4(xch, domid, vcpu, cpumap);
-	int i, len = get_cpumap_len(xch, cpumap);
+	xc_interface *c_xch = _H(xch);
+	int i, len = get_cpumap_len(c_xch, cpumap);
 	xc_cpumap_t c_cpumap;
+	uint32_t c_domid;
+	int c_vcpu;
 	int retval;
 
-	c_cpumap = xc_cpumap_alloc(_H(xch));
+	XC_STAT_OP("vcpu_affinity_set");
+	c_cpumap = xc_cpumap_alloc(c_xch);
 	if (c_cpumap == NULL)
-		failwith_xc(_H(xch));
+		failwith_xc(c_xch);
 
 	for (i=0; i<len; i++) {
 		if (Bool_val(Field(cpumap, i)))
 			c_cpumap[i/8] |= 1 << (i&7);
 	}
-	retval = xc_vcpu_setaffinity(_H(xch), _D(domid),
-	                             Int_val(vcpu),
-#ifdef HAVE_XEN_4_5
-                                     c_cpumap, c_cpumap, 0
-#else
-                                     c_cpumap
-#endif
-                                     );
+	c_domid = _D(domid);
+	c_vcpu = Int_val(vcpu);
+	xc_blocking_enter();
+	retval = vcpu_setaffinity(c_xch, c_domid, c_vcpu, c_cpumap);
+	xc_blocking_leave();
 	free(c_cpumap);
 
 	if (retval < 0)
-		failwith_xc(_H(xch));
+		failwith_xc(c_xch);
 	CAMLreturn(Val_unit);
 }
 
@@ -453,50 +2037,327 @@ CAMLprim value stub_xc_vcpu_getaffinity(value xch, value domid,
 {
 	CAMLparam3(xch, domid, vcpu);
 	CAMLlocal1(ret);
+	xc_interface *c_xch = _H(xch);
 	xc_cpumap_t c_cpumap;
-	int i, len = xc_get_max_cpus(_H(xch));
+	int i, len = xc_get_max_cpus(c_xch);
+	uint32_t c_domid;
+	int c_vcpu;
 	int retval;
 
-	c_cpumap = xc_cpumap_alloc(_H(xch));
+	XC_STAT_OP("vcpu_affinity_get");
+	c_cpumap = xc_cpumap_alloc(c_xch);
 	if (c_cpumap == NULL)
-		failwith_xc(_H(xch));
+		failwith_xc(c_xch);
+
+	c_domid = _D(domid);
+	c_vcpu = Int_val(vcpu);
+	xc_blocking_enter();
+	retval = vcpu_getaffinity(c_xch, c_domid, c_vcpu, c_cpumap);
+	xc_blocking_leave();
+	if (retval < 0) {
+		free(c_cpumap);
+		failwith_xc(c_xch);
+	}
+
+	ret = caml_alloc(len, 0);
+
+	for (i=0; i<len; i++) {
+		if (c_cpumap[i/8] & 1 << (i&7))
+			Store_field(ret, i, Val_true);
+		else
+			Store_field(ret, i, Val_false);
+	}
 
-	retval = xc_vcpu_getaffinity(_H(xch), _D(domid),
-	                             Int_val(vcpu),
-#ifdef HAVE_XEN_4_5
-                                     c_cpumap, NULL, 0
-#else
-                                     c_cpumap
-#endif
-                                     );
 	free(c_cpumap);
 
+	CAMLreturn(ret);
+}
+
+/* Bitmap cpumaps are OCaml bytes in the xc_cpumap_t layout: bit i % 8 of
+ * byte i / 8 is set if pcpu i is in the map. A map shorter than
+ * the hypervisor's is zero-extended, a longer one truncated. */
+static void cpumap_of_bytes(xc_cpumap_t c_cpumap, int size, value cpumap)
+{
+	int len = caml_string_length(cpumap);
+
+	if (len > size)
+		len = size;
+	memcpy(c_cpumap, String_val(cpumap), len);
+	memset(c_cpumap + len, 0, size - len);
+}
+
+CAMLprim value stub_xc_cpumap_size(value xch)
+{
+	CAMLparam1(xch);
+	xc_interface *c_xch = _H(xch);
+	int size = xc_get_cpumap_size(c_xch);
+
+	XC_STAT_OP("cpumap_size");
+	if (size <= 0)
+		failwith_xc(c_xch);
+	CAMLreturn(Val_int(size));
+}
+
+CAMLprim value stub_xc_vcpu_setaffinity_cpumap(value xch, value domid,
+                                               value vcpu, value cpumap)
+{
+	CAMLparam4(xch, domid, vcpu, cpumap);
+	xc_interface *c_xch = _H(xch);
+	int size = xc_get_cpumap_size(c_xch);
+	xc_cpumap_t c_cpumap;
+	uint32_t c_domid = _D(domid);
+	int c_vcpu = Int_val(vcpu);
+	int retval;
+
+	XC_STAT_OP("vcpu_affinity_set_cpumap");
+	c_cpumap = xc_cpumap_alloc(c_xch);
+	if (c_cpumap == NULL)
+		failwith_xc(c_xch);
+	cpumap_of_bytes(c_cpumap, size, cpumap);
+
+	xc_blocking_enter();
+	retval = vcpu_setaffinity(c_xch, c_domid, c_vcpu, c_cpumap);
+	xc_blocking_leave();
+	free(c_cpumap);
+
+	if (retval < 0)
+		failwith_xc(c_xch);
+	CAMLreturn(Val_unit);
+}
+
+CAMLprim value stub_xc_vcpu_getaffinity_cpumap(value xch, value domid,
+                                               value vcpu)
+{
+	CAMLparam3(xch, domid, vcpu);
+	CAMLlocal1(ret);
+	xc_interface *c_xch = _H(xch);
+	int size = xc_get_cpumap_size(c_xch);
+	xc_cpumap_t c_cpumap;
+	uint32_t c_domid = _D(domid);
+	int c_vcpu = Int_val(vcpu);
+	int retval;
+
+	XC_STAT_OP("vcpu_affinity_get_cpumap");
+	c_cpumap = xc_cpumap_alloc(c_xch);
+	if (c_cpumap == NULL)
+		failwith_xc(c_xch);
+
+	xc_blocking_enter();
+	retval = vcpu_getaffinity(c_xch, c_domid, c_vcpu, c_cpumap);
+	xc_blocking_leave();
+
 	if (retval < 0) {
 		free(c_cpumap);
-		failwith_xc(_H(xch));
+		failwith_xc(c_xch);
 	}
 
-	ret = caml_alloc(len, 0);
+	ret = caml_alloc_string(size);
+	memcpy(String_val(ret), c_cpumap, size);
+	free(c_cpumap);
+
+	CAMLreturn(ret);
+}
+
+CAMLprim value stub_xc_domain_set_affinity_all_vcpus(value xch, value domid,
+                                                     value cpumaps)
+{
+	CAMLparam3(xch, domid, cpumaps);
+	xc_interface *c_xch = _H(xch);
+	int nr_maps = Wosize_val(cpumaps);
+	int size = xc_get_cpumap_size(c_xch);
+	uint32_t c_domid = _D(domid);
+	xc_domaininfo_t info;
+	xc_cpumap_t scratch;
+	uint8_t *maps;
+	int i, ret;
+	uint32_t v;
+
+	XC_STAT_OP("domain_set_affinity_all_vcpus");
+	if (nr_maps < 1)
+		caml_invalid_argument("cpumaps");
+
+	scratch = xc_cpumap_alloc(c_xch);
+	if (scratch == NULL)
+		failwith_xc(c_xch);
+
+	maps = malloc((size_t) nr_maps * size);
+	if (!maps) {
+		free(scratch);
+		caml_raise_out_of_memory();
+	}
+	for (i = 0; i < nr_maps; i++)
+		cpumap_of_bytes(maps + (size_t) i * size, size,
+		                Field(cpumaps, i));
+
+	xc_blocking_enter();
+	ret = xc_domain_getinfolist(c_xch, c_domid, 1, &info);
+	if (ret != 1 || info.domain != c_domid) {
+		errno = ESRCH;
+		ret = -1;
+	} else if (nr_maps > 1 && nr_maps != info.max_vcpu_id + 1) {
+		ret = -2;
+	} else {
+		ret = 0;
+		for (v = 0; ret == 0 && v <= info.max_vcpu_id; v++) {
+			/* libxc writes the effective affinity back into the map */
+			memcpy(scratch, maps + (nr_maps > 1 ? v : 0) * (size_t) size,
+			       size);
+			if (vcpu_setaffinity(c_xch, c_domid, v, scratch) < 0)
+				ret = -1;
+		}
+	}
+	xc_blocking_leave();
+
+	free(scratch);
+	free(maps);
+
+	if (ret == -2)
+		caml_invalid_argument("cpumaps: expected one map, or one per vcpu");
+	if (ret < 0)
+		failwith_xc(c_xch);
+	CAMLreturn(Val_unit);
+}
+
+/* Fields of Xenctrl.domain_config */
+enum {
+	DCFG_SSIDREF,
+	DCFG_FLAGS,
+	DCFG_MAX_VCPUS,
+	DCFG_MAX_MEMKB,
+	DCFG_SHADOW_MB,
+	DCFG_ADDRESS_SIZE,
+	DCFG_SCHED,
+	DCFG_AFFINITY,
+};
+
+CAMLprim value stub_xc_domain_create_full(value xch, value config,
+                                          value handle)
+{
+	CAMLparam3(xch, config, handle);
+	CAMLlocal1(tmp);
+	xc_interface *c_xch = _H(xch);
+	xen_domain_handle_t h = { 0 };
+	uint32_t domid = 0;
+	uint32_t c_ssidref = Int32_val(Field(config, DCFG_SSIDREF));
+	unsigned int c_flags = 0;
+	unsigned int c_max_vcpus = Int_val(Field(config, DCFG_MAX_VCPUS));
+	uint64_t c_max_memkb = Int64_val(Field(config, DCFG_MAX_MEMKB));
+	int has_shadow = 0, has_width = 0, has_sched = 0;
+	unsigned long c_shadow_mb = 0;
+	int c_width = 0;
+	struct xen_domctl_sched_credit c_sdom = { 0 };
+	int nr_maps = Wosize_val(Field(config, DCFG_AFFINITY));
+	int size = 0;
+	uint8_t *maps = NULL;
+	xc_error saved_error;
+	int saved_errno = 0, rolled_back = 0;
+	unsigned int v;
+	int i, ret;
+	value l;
+
+	XC_STAT_OP("domain_create_full");
+	if (Wosize_val(handle) != 16)
+		caml_invalid_argument("Handle not a 16-integer array");
+	if (nr_maps > 1 && nr_maps != c_max_vcpus)
+		caml_invalid_argument("affinity: expected one map, or one per vcpu");
+
+	for (i = 0; i < sizeof(h); i++)
+		h[i] = Int_val(Field(handle, i)) & 0xff;
+
+	for (l = Field(config, DCFG_FLAGS); l != Val_emptylist; l = Field(l, 1))
+		c_flags |= domain_create_flag_table[Int_val(Field(l, 0))];
+
+	tmp = Field(config, DCFG_SHADOW_MB);
+	if (tmp != Val_none) {
+		has_shadow = 1;
+		c_shadow_mb = Int_val(Field(tmp, 0));
+	}
+	tmp = Field(config, DCFG_ADDRESS_SIZE);
+	if (tmp != Val_none) {
+		has_width = 1;
+		c_width = Int_val(Field(tmp, 0));
+	}
+	tmp = Field(config, DCFG_SCHED);
+	if (tmp != Val_none) {
+		has_sched = 1;
+		c_sdom.weight = Int_val(Field(Field(tmp, 0), 0));
+		c_sdom.cap = Int_val(Field(Field(tmp, 0), 1));
+	}
+
+	/* The cpumaps are copied out of the OCaml heap before the runtime
+	 * lock is released */
+	if (nr_maps > 0) {
+		size = xc_get_cpumap_size(c_xch);
+		if (size <= 0)
+			failwith_xc(c_xch);
+		maps = malloc((size_t) (nr_maps + 1) * size);
+		if (!maps)
+			caml_raise_out_of_memory();
+		for (i = 0; i < nr_maps; i++)
+			cpumap_of_bytes(maps + (size_t) i * size, size,
+			                Field(Field(config, DCFG_AFFINITY), i));
+	}
+
+	xc_blocking_enter();
+	ret = xc_domain_create(c_xch, c_ssidref, h, c_flags, &domid
+#ifdef DOMAIN_CREATE_HAS_CONFIG
+		,NULL
+#endif
+		);
+	if (ret >= 0) {
+		ret = xc_domain_max_vcpus(c_xch, domid, c_max_vcpus);
+		if (ret == 0)
+			ret = xc_domain_setmaxmem(c_xch, domid, c_max_memkb);
+		if (ret == 0 && has_shadow)
+			ret = xc_shadow_control(c_xch, domid,
+			                        XEN_DOMCTL_SHADOW_OP_SET_ALLOCATION,
+			                        NULL, 0, &c_shadow_mb, 0, NULL);
+		if (ret == 0 && has_width)
+			ret = xc_domain_set_machine_address_size(c_xch, domid,
+			                                         c_width);
+		if (ret == 0 && has_sched)
+			ret = xc_sched_credit_domain_set(c_xch, domid, &c_sdom);
+		for (v = 0; ret == 0 && nr_maps > 0 && v < c_max_vcpus; v++) {
+			/* libxc writes the effective affinity back into the
+			 * map, so each vcpu gets a fresh copy in the last slot */
+			uint8_t *scratch = maps + (size_t) nr_maps * size;
+
+			memcpy(scratch, maps + (nr_maps > 1 ? v : 0) * (size_t) size,
+			       size);
+			ret = vcpu_setaffinity(c_xch, domid, v, scratch) < 0 ? -1 : 0;
+		}
 
-	for (i=0; i<len; i++) {
-		if (c_cpumap[i/8] & 1 << (i&7))
-			Store_field(ret, i, Val_true);
-		else
-			Store_field(ret, i, Val_false);
+		/* Destroying the domain overwrites the error being reported */
+		if (ret != 0) {
+			saved_error = *xc_get_last_error(c_xch);
+			saved_errno = errno;
+			xc_domain_destroy(c_xch, domid);
+			rolled_back = 1;
+		}
 	}
+	xc_blocking_leave();
 
-	free(c_cpumap);
+	free(maps);
 
-	CAMLreturn(ret);
+	if (rolled_back)
+		failwith_xc_error(&saved_error, saved_errno);
+	if (ret < 0)
+		failwith_xc(c_xch);
+	CAMLreturn(Val_int(domid));
 }
 
 CAMLprim value stub_xc_sched_id(value xch)
 {
 	CAMLparam1(xch);
-	int sched_id;
+	xc_interface *c_xch = _H(xch);
+	int sched_id, r;
 
-	if (xc_sched_id(_H(xch), &sched_id))
-		failwith_xc(_H(xch));
+	XC_STAT_OP("sched_id");
+	xc_blocking_enter();
+	r = xc_sched_id(c_xch, &sched_id);
+	xc_blocking_leave();
+	if (r)
+		failwith_xc(c_xch);
 	CAMLreturn(Val_int(sched_id));
 }
 
@@ -505,63 +2366,195 @@ CAMLprim value stub_xc_evtchn_alloc_unbound(value xch,
                                             value remote_domid)
 {
 	CAMLparam3(xch, local_domid, remote_domid);
+	xc_interface *c_xch = _H(xch);
 	int result;
 
 	uint32_t c_local_domid = _D(local_domid);
 	uint32_t c_remote_domid = _D(remote_domid);
 
-	caml_enter_blocking_section();
-	result = xc_evtchn_alloc_unbound(_H(xch), c_local_domid,
+	XC_STAT_OP("evtchn_alloc_unbound");
+	xc_blocking_enter();
+	result = xc_evtchn_alloc_unbound(c_xch, c_local_domid,
 	                                     c_remote_domid);
-	caml_leave_blocking_section();
+	xc_blocking_leave();
 
 	if (result < 0)
-		failwith_xc(_H(xch));
+		failwith_xc(c_xch);
 	CAMLreturn(Val_int(result));
 }
 
 CAMLprim value stub_xc_evtchn_reset(value xch, value domid)
 {
 	CAMLparam2(xch, domid);
+	xc_interface *c_xch = _H(xch);
 	int r;
+	uint32_t c_domid = _D(domid);
 
-	r = xc_evtchn_reset(_H(xch), _D(domid));
+	XC_STAT_OP("evtchn_reset");
+	xc_blocking_enter();
+	r = xc_evtchn_reset(c_xch, c_domid);
+	xc_blocking_leave();
 	if (r < 0)
-		failwith_xc(_H(xch));
+		failwith_xc(c_xch);
 	CAMLreturn(Val_unit);
 }
 
 
 #define RING_SIZE 32768
-static char ring[RING_SIZE];
 
 CAMLprim value stub_xc_readconsolering(value xch)
 {
 	unsigned int size = RING_SIZE - 1;
-	char *ring_ptr = ring;
+	char *ring;
 	int retval;
 
 	CAMLparam1(xch);
+	CAMLlocal1(result);
+	xc_interface *c_xch = _H(xch);
+
+	XC_STAT_OP("readconsolering");
+	ring = malloc(RING_SIZE);
+	if (!ring)
+		caml_raise_out_of_memory();
 
-	caml_enter_blocking_section();
-	retval = xc_readconsolering(_H(xch), ring_ptr, &size, 0, 0, NULL);
-	caml_leave_blocking_section();
+	xc_blocking_enter();
+	retval = xc_readconsolering(c_xch, ring, &size, 0, 0, NULL);
+	xc_blocking_leave();
 
-	if (retval)
-		failwith_xc(_H(xch));
+	if (retval) {
+		free(ring);
+		failwith_xc(c_xch);
+	}
 
 	ring[size] = '\0';
-	CAMLreturn(caml_copy_string(ring));
+	result = caml_copy_string(ring);
+	free(ring);
+	CAMLreturn(result);
+}
+
+/* A console reader keeps the read cursor of an incremental
+ * xc_readconsolering so that each call returns only new characters */
+struct console_reader {
+	uint32_t index;
+	unsigned int size;
+	char buf[];
+};
+
+#define Console_val(v) (*((struct console_reader **) Data_custom_val(v)))
+
+static void console_reader_finalize(value v)
+{
+	free(Console_val(v));
+}
+
+static struct custom_operations console_reader_ops = {
+	"xenctrl.console_reader",
+	console_reader_finalize,
+	custom_compare_default,
+	custom_hash_default,
+	custom_serialize_default,
+	custom_deserialize_default,
+	custom_compare_ext_default,
+};
+
+CAMLprim value stub_xc_console_reader_create(value size)
+{
+	CAMLparam1(size);
+	CAMLlocal1(result);
+	struct console_reader *r;
+	intnat c_size = Long_val(size);
+
+	if (c_size <= 0 || c_size > (1 << 30))
+		caml_invalid_argument("console_reader_create");
+
+	r = malloc(sizeof(*r) + c_size);
+	if (!r)
+		caml_raise_out_of_memory();
+	r->index = 0;
+	r->size = c_size;
+
+	result = caml_alloc_custom(&console_reader_ops, sizeof(r), 0, 1);
+	Console_val(result) = r;
+	CAMLreturn(result);
+}
+
+/* Reads at most max new characters into r->buf */
+static unsigned int console_reader_fill(xc_interface *xch,
+                                        struct console_reader *r,
+                                        unsigned int max)
+{
+	unsigned int nr = max;
+	uint32_t index = r->index;
+	int retval;
+
+	xc_blocking_enter();
+	retval = xc_readconsolering(xch, r->buf, &nr, 0, 1, &index);
+	xc_blocking_leave();
+
+	if (retval)
+		failwith_xc(xch);
+
+	r->index = index;
+	return nr;
+}
+
+CAMLprim value stub_xc_console_reader_read(value xch, value reader)
+{
+	CAMLparam2(xch, reader);
+	CAMLlocal1(result);
+	xc_interface *c_xch = _H(xch);
+	struct console_reader *r = Console_val(reader);
+	unsigned int nr;
+
+	XC_STAT_OP("console_reader_read");
+	nr = console_reader_fill(c_xch, r, r->size);
+	result = caml_alloc_string(nr);
+	memcpy(Bytes_val(result), r->buf, nr);
+	CAMLreturn(result);
+}
+
+CAMLprim value stub_xc_console_reader_read_into(value xch, value reader,
+                                                value buf, value off,
+                                                value len)
+{
+	CAMLparam5(xch, reader, buf, off, len);
+	xc_interface *c_xch = _H(xch);
+	struct console_reader *r = Console_val(reader);
+	intnat c_off = Long_val(off), c_len = Long_val(len);
+	unsigned int nr;
+
+	XC_STAT_OP("console_reader_read_into");
+	if (c_off < 0 || c_len < 0 ||
+	    c_off > (intnat) caml_string_length(buf) - c_len)
+		caml_invalid_argument("console_reader_read_into");
+
+	/* buf may move while the runtime lock is released, so the
+	 * characters are staged in the reader's own buffer */
+	nr = console_reader_fill(c_xch, r,
+	                         c_len < r->size ? c_len : r->size);
+	memcpy(Bytes_val(buf) + c_off, r->buf, nr);
+	CAMLreturn(Val_int(nr));
 }
 
 CAMLprim value stub_xc_send_debug_keys(value xch, value keys)
 {
 	CAMLparam2(xch, keys);
+	xc_interface *c_xch = _H(xch);
+	char *c_keys;
 	int r;
 
-	r = xc_send_debug_keys(_H(xch), String_val(keys));
+	XC_STAT_OP("send_debug_keys");
+	/* keys may move once the runtime lock is released */
+	c_keys = strdup(String_val(keys));
+	if (!c_keys)
+		caml_raise_out_of_memory();
+
+	xc_blocking_enter();
+	r = xc_send_debug_keys(c_xch, c_keys);
+	xc_blocking_leave();
+	free(c_keys);
 	if (r)
-		failwith_xc(_H(xch));
+		failwith_xc(c_xch);
 	CAMLreturn(Val_unit);
 }
 
@@ -569,15 +2562,17 @@ CAMLprim value stub_xc_physinfo(value xch)
 {
 	CAMLparam1(xch);
 	CAMLlocal3(physinfo, cap_list, tmp);
+	xc_interface *c_xch = _H(xch);
 	xc_physinfo_t c_physinfo;
 	int r;
 
-	caml_enter_blocking_section();
-	r = xc_physinfo(_H(xch), &c_physinfo);
-	caml_leave_blocking_section();
+	XC_STAT_OP("physinfo");
+	xc_blocking_enter();
+	r = xc_physinfo(c_xch, &c_physinfo);
+	xc_blocking_leave();
 
 	if (r)
-		failwith_xc(_H(xch));
+		failwith_xc(c_xch);
 
 	tmp = cap_list = Val_emptylist;
 	for (r = 0; r < 2; r++) {
@@ -608,23 +2603,28 @@ CAMLprim value stub_xc_pcpu_info(value xch, value nr_cpus)
 {
 	CAMLparam2(xch, nr_cpus);
 	CAMLlocal2(pcpus, v);
+	struct xc_handle *c_handle = Handle_val(xch);
+	xc_interface *c_xch = c_handle->xch;
+	struct xc_buffer b;
 	xc_cpuinfo_t *info;
 	int r, size;
 
+	XC_STAT_OP("pcpu_info");
 	if (Int_val(nr_cpus) < 1)
 		caml_invalid_argument("nr_cpus");
 
-	info = calloc(Int_val(nr_cpus) + 1, sizeof(*info));
-	if (!info)
+	if (xc_buffer_get(c_handle, &b,
+	                  (Int_val(nr_cpus) + 1) * sizeof(*info)) < 0)
 		caml_raise_out_of_memory();
+	info = b.data;
 
-	caml_enter_blocking_section();
-	r = xc_getcpuinfo(_H(xch), Int_val(nr_cpus), info, &size);
-	caml_leave_blocking_section();
+	xc_blocking_enter();
+	r = xc_getcpuinfo(c_xch, Int_val(nr_cpus), info, &size);
+	xc_blocking_leave();
 
 	if (r) {
-		free(info);
-		failwith_xc(_H(xch));
+		xc_buffer_put(&b);
+		failwith_xc(c_xch);
 	}
 
 	if (size > 0) {
@@ -636,24 +2636,233 @@ CAMLprim value stub_xc_pcpu_info(value xch, value nr_cpus)
 		}
 	} else
 		pcpus = Atom(0);
-	free(info);
+	xc_buffer_put(&b);
 	CAMLreturn(pcpus);
 }
 
+/* A pCPU sampler remembers the idle time of every pCPU at the previous
+ * sample, so that utilisation is computed without boxing an int64 per
+ * pCPU per sample */
+struct pcpu_sampler {
+	int nr_cpus;
+	int primed;
+	uint64_t stamp;
+	uint64_t *prev_idle;
+	xc_cpuinfo_t *info;
+};
+
+#define Pcpu_sampler_val(v) (*((struct pcpu_sampler **) Data_custom_val(v)))
+
+static void pcpu_sampler_finalize(value v)
+{
+	struct pcpu_sampler *s = Pcpu_sampler_val(v);
+
+	free(s->prev_idle);
+	free(s->info);
+	free(s);
+}
+
+static struct custom_operations pcpu_sampler_ops = {
+	"xenctrl.pcpu_sampler",
+	pcpu_sampler_finalize,
+	custom_compare_default,
+	custom_hash_default,
+	custom_serialize_default,
+	custom_deserialize_default,
+	custom_compare_ext_default,
+};
+
+CAMLprim value stub_xc_pcpu_sampler_create(value nr_cpus)
+{
+	CAMLparam1(nr_cpus);
+	CAMLlocal1(result);
+	struct pcpu_sampler *s;
+	int c_nr_cpus = Int_val(nr_cpus);
+
+	if (c_nr_cpus < 1)
+		caml_invalid_argument("nr_cpus");
+
+	s = calloc(1, sizeof(*s));
+	if (s) {
+		s->nr_cpus = c_nr_cpus;
+		s->prev_idle = calloc(c_nr_cpus, sizeof(*s->prev_idle));
+		s->info = calloc(c_nr_cpus, sizeof(*s->info));
+	}
+	if (!s || !s->prev_idle || !s->info) {
+		if (s) {
+			free(s->prev_idle);
+			free(s->info);
+		}
+		free(s);
+		caml_raise_out_of_memory();
+	}
+
+	result = caml_alloc_custom(&pcpu_sampler_ops, sizeof(s), 0, 1);
+	Pcpu_sampler_val(result) = s;
+	CAMLreturn(result);
+}
+
+CAMLprim value stub_xc_pcpu_sample(value xch, value sampler, value busy)
+{
+	CAMLparam3(xch, sampler, busy);
+	xc_interface *c_xch = _H(xch);
+	struct pcpu_sampler *s = Pcpu_sampler_val(sampler);
+	struct caml_ba_array *ba = Caml_ba_array_val(busy);
+	double *out = (double *) ba->data;
+	struct timespec ts;
+	uint64_t now, elapsed, idle;
+	double b;
+	int r, size, i, n = 0;
+
+	XC_STAT_OP("pcpu_sample");
+	xc_blocking_enter();
+	r = xc_getcpuinfo(c_xch, s->nr_cpus, s->info, &size);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	xc_blocking_leave();
+
+	if (r)
+		failwith_xc(c_xch);
+
+	now = (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	elapsed = now - s->stamp;
+
+	/* idle times are in nanoseconds, like the monotonic clock */
+	if (s->primed && elapsed > 0) {
+		n = size < ba->dim[0] ? size : ba->dim[0];
+		for (i = 0; i < n; i++) {
+			idle = s->info[i].idletime - s->prev_idle[i];
+			b = 1.0 - (double) idle / (double) elapsed;
+			out[i] = b < 0.0 ? 0.0 : (b > 1.0 ? 1.0 : b);
+		}
+	}
+
+	for (i = 0; i < size; i++)
+		s->prev_idle[i] = s->info[i].idletime;
+	s->stamp = now;
+	s->primed = 1;
+
+	CAMLreturn(Val_int(n));
+}
+
+CAMLprim value stub_xc_cputopoinfo(value xch)
+{
+	CAMLparam1(xch);
+	CAMLlocal2(result, tmp);
+	xc_interface *c_xch = _H(xch);
+#ifdef HAVE_XEN_4_6
+	xc_cputopo_t *topo = NULL;
+	unsigned int nr = 0, i;
+	int r;
+
+	XC_STAT_OP("cputopoinfo");
+	/* Sizing and filling are timed as one call */
+	xc_blocking_enter();
+	r = xc_cputopoinfo(c_xch, &nr, NULL);
+	if (!r && (topo = calloc(nr ? nr : 1, sizeof(*topo))))
+		r = xc_cputopoinfo(c_xch, &nr, topo);
+	xc_blocking_leave();
+	if (r) {
+		free(topo);
+		failwith_xc(c_xch);
+	}
+	if (!topo)
+		caml_raise_out_of_memory();
+
+#define TOPO_ID(x, invalid) ((x) == (invalid) ? Val_int(-1) : Val_int(x))
+	result = caml_alloc(nr, 0);
+	for (i = 0; i < nr; i++) {
+		tmp = caml_alloc_tuple(3);
+		Store_field(tmp, 0, TOPO_ID(topo[i].core, XEN_INVALID_CORE_ID));
+		Store_field(tmp, 1, TOPO_ID(topo[i].socket, XEN_INVALID_SOCKET_ID));
+		Store_field(tmp, 2, TOPO_ID(topo[i].node, XEN_INVALID_NODE_ID));
+		Store_field(result, i, tmp);
+	}
+#undef TOPO_ID
+	free(topo);
+#else
+	caml_failwith("xc_cputopoinfo: not implemented");
+#endif
+	CAMLreturn(result);
+}
+
+CAMLprim value stub_xc_numainfo(value xch)
+{
+	CAMLparam1(xch);
+	CAMLlocal5(result, memsize, memfree, distances, row);
+	xc_interface *c_xch = _H(xch);
+#ifdef HAVE_XEN_4_6
+	xc_meminfo_t *meminfo = NULL;
+	uint32_t *distance = NULL;
+	unsigned int nr = 0, i, j;
+	int r;
+
+	XC_STAT_OP("numainfo");
+	/* Sizing and filling are timed as one call */
+	xc_blocking_enter();
+	r = xc_numainfo(c_xch, &nr, NULL, NULL);
+	if (!r) {
+		meminfo = calloc(nr ? nr : 1, sizeof(*meminfo));
+		distance = calloc(nr ? nr * nr : 1, sizeof(*distance));
+		if (meminfo && distance)
+			r = xc_numainfo(c_xch, &nr, meminfo, distance);
+	}
+	xc_blocking_leave();
+	if (r) {
+		free(meminfo);
+		free(distance);
+		failwith_xc(c_xch);
+	}
+	if (!meminfo || !distance) {
+		free(meminfo);
+		free(distance);
+		caml_raise_out_of_memory();
+	}
+
+	memsize = caml_alloc(nr, 0);
+	memfree = caml_alloc(nr, 0);
+	distances = caml_alloc(nr, 0);
+	for (i = 0; i < nr; i++) {
+		Store_field(memsize, i, caml_copy_int64(
+			meminfo[i].memsize == XEN_INVALID_MEM_SZ ?
+			-1 : (int64_t) meminfo[i].memsize));
+		Store_field(memfree, i, caml_copy_int64(
+			meminfo[i].memfree == XEN_INVALID_MEM_SZ ?
+			-1 : (int64_t) meminfo[i].memfree));
+		row = caml_alloc(nr, 0);
+		for (j = 0; j < nr; j++)
+			Store_field(row, j, distance[i * nr + j] == XEN_INVALID_NODE_DIST ?
+			            Val_int(-1) : Val_int(distance[i * nr + j]));
+		Store_field(distances, i, row);
+	}
+	free(meminfo);
+	free(distance);
+
+	result = caml_alloc_tuple(3);
+	Store_field(result, 0, memsize);
+	Store_field(result, 1, memfree);
+	Store_field(result, 2, distances);
+#else
+	caml_failwith("xc_numainfo: not implemented");
+#endif
+	CAMLreturn(result);
+}
+
 CAMLprim value stub_xc_domain_setmaxmem(value xch, value domid,
                                         value max_memkb)
 {
 	CAMLparam3(xch, domid, max_memkb);
+	xc_interface *c_xch = _H(xch);
 	int retval;
 
 	uint32_t c_domid = _D(domid);
 	unsigned int c_max_memkb = Int64_val(max_memkb);
-	caml_enter_blocking_section();
-	retval = xc_domain_setmaxmem(_H(xch), c_domid,
+	XC_STAT_OP("domain_setmaxmem");
+	xc_blocking_enter();
+	retval = xc_domain_setmaxmem(c_xch, c_domid,
 	                                 c_max_memkb);
-	caml_leave_blocking_section();
+	xc_blocking_leave();
 	if (retval)
-		failwith_xc(_H(xch));
+		failwith_xc(c_xch);
 	CAMLreturn(Val_unit);
 }
 
@@ -661,13 +2870,18 @@ CAMLprim value stub_xc_domain_set_memmap_limit(value xch, value domid,
                                                value map_limitkb)
 {
 	CAMLparam3(xch, domid, map_limitkb);
+	xc_interface *c_xch = _H(xch);
 	unsigned long v;
 	int retval;
+	uint32_t c_domid = _D(domid);
 
+	XC_STAT_OP("domain_set_memmap_limit");
 	v = Int64_val(map_limitkb);
-	retval = xc_domain_set_memmap_limit(_H(xch), _D(domid), v);
+	xc_blocking_enter();
+	retval = xc_domain_set_memmap_limit(c_xch, c_domid, v);
+	xc_blocking_leave();
 	if (retval)
-		failwith_xc(_H(xch));
+		failwith_xc(c_xch);
 
 	CAMLreturn(Val_unit);
 }
@@ -677,18 +2891,20 @@ CAMLprim value stub_xc_domain_memory_increase_reservation(value xch,
                                                           value mem_kb)
 {
 	CAMLparam3(xch, domid, mem_kb);
+	xc_interface *c_xch = _H(xch);
 	int retval;
 
 	unsigned long nr_extents = ((unsigned long)(Int64_val(mem_kb))) >> (PAGE_SHIFT - 10);
 
 	uint32_t c_domid = _D(domid);
-	caml_enter_blocking_section();
-	retval = xc_domain_increase_reservation_exact(_H(xch), c_domid,
+	XC_STAT_OP("domain_memory_increase_reservation");
+	xc_blocking_enter();
+	retval = xc_domain_increase_reservation_exact(c_xch, c_domid,
 							  nr_extents, 0, 0, NULL);
-	caml_leave_blocking_section();
+	xc_blocking_leave();
 
 	if (retval)
-		failwith_xc(_H(xch));
+		failwith_xc(c_xch);
 	CAMLreturn(Val_unit);
 }
 
@@ -697,12 +2913,17 @@ CAMLprim value stub_xc_domain_set_machine_address_size(value xch,
 						       value width)
 {
 	CAMLparam3(xch, domid, width);
+	xc_interface *c_xch = _H(xch);
 	uint32_t c_domid = _D(domid);
 	int c_width = Int_val(width);
+	int retval;
 
-	int retval = xc_domain_set_machine_address_size(_H(xch), c_domid, c_width);
+	XC_STAT_OP("domain_set_machine_address_size");
+	xc_blocking_enter();
+	retval = xc_domain_set_machine_address_size(c_xch, c_domid, c_width);
+	xc_blocking_leave();
 	if (retval)
-		failwith_xc(_H(xch));
+		failwith_xc(c_xch);
 	CAMLreturn(Val_unit);
 }
 
@@ -710,11 +2931,16 @@ CAMLprim value stub_xc_domain_get_machine_address_size(value xch,
                                                        value domid)
 {
 	CAMLparam2(xch, domid);
+	xc_interface *c_xch = _H(xch);
 	int retval;
+	uint32_t c_domid = _D(domid);
 
-	retval = xc_domain_get_machine_address_size(_H(xch), _D(domid));
+	XC_STAT_OP("domain_get_machine_address_size");
+	xc_blocking_enter();
+	retval = xc_domain_get_machine_address_size(c_xch, c_domid);
+	xc_blocking_leave();
 	if (retval < 0)
-		failwith_xc(_H(xch));
+		failwith_xc(c_xch);
 	CAMLreturn(Val_int(retval));
 }
 
@@ -724,35 +2950,47 @@ CAMLprim value stub_xc_domain_cpuid_set(value xch, value domid,
 {
 	CAMLparam4(xch, domid, input, config);
 	CAMLlocal2(array, tmp);
+	xc_interface *c_xch = _H(xch);
 #if defined(__i386__) || defined(__x86_64__)
 	int r;
 	unsigned int c_input[2];
+	uint32_t c_domid = _D(domid);
 	char *c_config[4], *out_config[4];
+	/* Copies of the config strings, which may move once the runtime
+	 * lock is released, and the output buffers */
+	char in_buf[4][33], out_buf[4][33];
 
-	c_config[0] = string_of_option_array(config, 0);
-	c_config[1] = string_of_option_array(config, 1);
-	c_config[2] = string_of_option_array(config, 2);
-	c_config[3] = string_of_option_array(config, 3);
+	XC_STAT_OP("domain_cpuid_set");
+	for (r = 0; r < 4; r++) {
+		c_config[r] = string_of_option_array(config, r);
+		if (c_config[r]) {
+			strncpy(in_buf[r], c_config[r], sizeof(in_buf[r]) - 1);
+			in_buf[r][sizeof(in_buf[r]) - 1] = '\0';
+			c_config[r] = in_buf[r];
+		}
+		out_config[r] = c_config[r] ? out_buf[r] : NULL;
+	}
 
 	cpuid_input_of_val(c_input[0], c_input[1], input);
 
+	xc_blocking_enter();
+	r = xc_cpuid_set(c_xch, c_domid,
+			 c_input, (const char **)c_config, out_config);
+	xc_blocking_leave();
+	if (r < 0)
+		failwith_xc(c_xch);
+
 	array = caml_alloc(4, 0);
 	for (r = 0; r < 4; r++) {
 		tmp = Val_none;
 		if (c_config[r]) {
 			tmp = caml_alloc_small(1, 0);
-			Field(tmp, 0) = caml_alloc_string(32);
+			Field(tmp, 0) = Val_unit;
+			Store_field(tmp, 0, caml_alloc_string(32));
+			memcpy(String_val(Field(tmp, 0)), out_buf[r], 32);
 		}
 		Store_field(array, r, tmp);
 	}
-
-	for (r = 0; r < 4; r++)
-		out_config[r] = (c_config[r]) ? String_val(Field(Field(array, r), 0)) : NULL;
-
-	r = xc_cpuid_set(_H(xch), _D(domid),
-			 c_input, (const char **)c_config, out_config);
-	if (r < 0)
-		failwith_xc(_H(xch));
 #else
 	caml_failwith("xc_domain_cpuid_set: not implemented");
 #endif
@@ -762,16 +3000,21 @@ CAMLprim value stub_xc_domain_cpuid_set(value xch, value domid,
 CAMLprim value stub_xc_domain_cpuid_apply_policy(value xch, value domid)
 {
 	CAMLparam2(xch, domid);
+	xc_interface *c_xch = _H(xch);
 #if defined(__i386__) || defined(__x86_64__)
 	int r;
+	uint32_t c_domid = _D(domid);
 
-	r = xc_cpuid_apply_policy(_H(xch), _D(domid)
+	XC_STAT_OP("domain_cpuid_apply_policy");
+	xc_blocking_enter();
+	r = xc_cpuid_apply_policy(c_xch, c_domid
 #ifdef XEN_SYSCTL_cpu_featureset_raw
 				  ,NULL,0
 #endif
 				  );
+	xc_blocking_leave();
 	if (r < 0)
-		failwith_xc(_H(xch));
+		failwith_xc(c_xch);
 #else
 	caml_failwith("xc_domain_cpuid_apply_policy: not implemented");
 #endif
@@ -782,17 +3025,19 @@ CAMLprim value stub_xc_version_version(value xch)
 {
 	CAMLparam1(xch);
 	CAMLlocal1(result);
+	xc_interface *c_xch = _H(xch);
 	xen_extraversion_t extra;
 	long packed;
 	int retval;
 
-	caml_enter_blocking_section();
-	packed = xc_version(_H(xch), XENVER_version, NULL);
-	retval = xc_version(_H(xch), XENVER_extraversion, &extra);
-	caml_leave_blocking_section();
+	XC_STAT_OP("version");
+	xc_blocking_enter();
+	packed = xc_version(c_xch, XENVER_version, NULL);
+	retval = xc_version(c_xch, XENVER_extraversion, &extra);
+	xc_blocking_leave();
 
 	if (retval)
-		failwith_xc(_H(xch));
+		failwith_xc(c_xch);
 
 	result = caml_alloc_tuple(3);
 
@@ -808,15 +3053,17 @@ CAMLprim value stub_xc_version_compile_info(value xch)
 {
 	CAMLparam1(xch);
 	CAMLlocal1(result);
+	xc_interface *c_xch = _H(xch);
 	xen_compile_info_t ci;
 	int retval;
 
-	caml_enter_blocking_section();
-	retval = xc_version(_H(xch), XENVER_compile_info, &ci);
-	caml_leave_blocking_section();
+	XC_STAT_OP("version_compile_info");
+	xc_blocking_enter();
+	retval = xc_version(c_xch, XENVER_compile_info, &ci);
+	xc_blocking_leave();
 
 	if (retval)
-		failwith_xc(_H(xch));
+		failwith_xc(c_xch);
 
 	result = caml_alloc_tuple(4);
 
@@ -832,14 +3079,15 @@ CAMLprim value stub_xc_version_compile_info(value xch)
 static value xc_version_single_string(value xch, int code, void *info)
 {
 	CAMLparam1(xch);
+	xc_interface *c_xch = _H(xch);
 	int retval;
 
-	caml_enter_blocking_section();
-	retval = xc_version(_H(xch), code, info);
-	caml_leave_blocking_section();
+	xc_blocking_enter();
+	retval = xc_version(c_xch, code, info);
+	xc_blocking_leave();
 
 	if (retval)
-		failwith_xc(_H(xch));
+		failwith_xc(c_xch);
 
 	CAMLreturn(caml_copy_string((char *)info));
 }
@@ -849,6 +3097,7 @@ CAMLprim value stub_xc_version_changeset(value xch)
 {
 	xen_changeset_info_t ci;
 
+	XC_STAT_OP("version_changeset");
 	return xc_version_single_string(xch, XENVER_changeset, &ci);
 }
 
@@ -857,9 +3106,80 @@ CAMLprim value stub_xc_version_capabilities(value xch)
 {
 	xen_capabilities_info_t ci;
 
+	XC_STAT_OP("version_capabilities");
 	return xc_version_single_string(xch, XENVER_capabilities, &ci);
 }
 
+/*
+ * UUIDs are held as their 16 raw bytes. The codec converts with lookup
+ * tables, a byte at a time, with no per-character branching.
+ */
+#define UUID_STRLEN 36
+
+static const char uuid_hex[] = "0123456789abcdef";
+
+/* Offsets of the hex digit pairs in "xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx" */
+static const unsigned char uuid_pair_offset[16] = {
+	0, 2, 4, 6, 9, 11, 14, 16, 19, 21, 24, 26, 28, 30, 32, 34,
+};
+
+/* Value of a hex digit, or 0xff */
+static const unsigned char uuid_digit[256] = {
+	[0 ... 255] = 0xff,
+	['0'] = 0, ['1'] = 1, ['2'] = 2, ['3'] = 3, ['4'] = 4,
+	['5'] = 5, ['6'] = 6, ['7'] = 7, ['8'] = 8, ['9'] = 9,
+	['a'] = 10, ['b'] = 11, ['c'] = 12, ['d'] = 13, ['e'] = 14, ['f'] = 15,
+	['A'] = 10, ['B'] = 11, ['C'] = 12, ['D'] = 13, ['E'] = 14, ['F'] = 15,
+};
+
+CAMLprim value stub_xc_uuid_of_string(value s)
+{
+	CAMLparam1(s);
+	CAMLlocal1(result);
+	const unsigned char *c = (const unsigned char *) String_val(s);
+	unsigned char bytes[16], bad = 0;
+	int i;
+
+	if (caml_string_length(s) != UUID_STRLEN ||
+	    c[8] != '-' || c[13] != '-' || c[18] != '-' || c[23] != '-')
+		caml_invalid_argument("uuid_of_string");
+
+	for (i = 0; i < 16; i++) {
+		unsigned char hi = uuid_digit[c[uuid_pair_offset[i]]];
+		unsigned char lo = uuid_digit[c[uuid_pair_offset[i] + 1]];
+
+		bad |= (hi | lo) & 0xf0;
+		bytes[i] = (hi << 4) | lo;
+	}
+	if (bad)
+		caml_invalid_argument("uuid_of_string");
+
+	result = caml_alloc_string(16);
+	memcpy(Bytes_val(result), bytes, 16);
+	CAMLreturn(result);
+}
+
+CAMLprim value stub_xc_uuid_to_string(value uuid)
+{
+	CAMLparam1(uuid);
+	CAMLlocal1(result);
+	const unsigned char *b;
+	char *c;
+	int i;
+
+	if (caml_string_length(uuid) != 16)
+		caml_invalid_argument("uuid_to_string");
+
+	result = caml_alloc_string(UUID_STRLEN);
+	c = (char *) Bytes_val(result);
+	b = (const unsigned char *) String_val(uuid);
+	c[8] = c[13] = c[18] = c[23] = '-';
+	for (i = 0; i < 16; i++) {
+		c[uuid_pair_offset[i]] = uuid_hex[b[i] >> 4];
+		c[uuid_pair_offset[i] + 1] = uuid_hex[b[i] & 0xf];
+	}
+	CAMLreturn(result);
+}
 
 CAMLprim value stub_pages_to_kib(value pages)
 {
@@ -874,24 +3194,80 @@ CAMLprim value stub_map_foreign_range(value xch, value dom,
 {
 	CAMLparam4(xch, dom, size, mfn);
 	CAMLlocal1(result);
-	struct mmap_interface *intf;
+	xc_interface *c_xch = _H(xch);
+	void *addr;
+	intnat n = Long_val(size);
+	size_t c_size;
 	uint32_t c_dom;
 	unsigned long c_mfn;
 
-	result = caml_alloc(sizeof(struct mmap_interface), Abstract_tag);
-	intf = (struct mmap_interface *) result;
-
-	intf->len = Int_val(size);
-
+	XC_STAT_OP("map_foreign_range");
+	/* libxc takes the size as an int */
+	if (n <= 0 || n > INT_MAX || (n & ~PAGE_MASK) != 0)
+		caml_invalid_argument("map_foreign_range: size");
+	c_size = n;
 	c_dom = _D(dom);
 	c_mfn = Nativeint_val(mfn);
-	caml_enter_blocking_section();
-	intf->addr = xc_map_foreign_range(_H(xch), c_dom,
-	                                  intf->len, PROT_READ|PROT_WRITE,
-	                                  c_mfn);
-	caml_leave_blocking_section();
-	if (!intf->addr)
-		caml_failwith("xc_map_foreign_range error");
+	result = alloc_mmap_interface(c_size);
+	xc_blocking_enter();
+	addr = xc_map_foreign_range(c_xch, c_dom,
+	                            c_size, PROT_READ|PROT_WRITE,
+	                            c_mfn);
+	xc_blocking_leave();
+	if (!addr)
+		xc_failwith("xc_map_foreign_range error");
+	Intf_val(result)->addr = addr;
+	CAMLreturn(result);
+}
+
+CAMLprim value stub_map_foreign_bulk(value xch, value dom, value prot,
+                                     value frames, value errors)
+{
+	CAMLparam5(xch, dom, prot, frames, errors);
+	CAMLlocal1(result);
+	xc_interface *c_xch = _H(xch);
+	struct caml_ba_array *c_frames = Caml_ba_array_val(frames);
+	struct caml_ba_array *c_errors = Caml_ba_array_val(errors);
+	intnat i, nr = c_frames->dim[0];
+	xen_pfn_t *pfns = NULL;
+	uint32_t c_dom = _D(dom);
+	int c_prot;
+	void *addr;
+
+	XC_STAT_OP("map_foreign_bulk");
+	switch (Int_val(prot)) {
+	case 0: c_prot = PROT_READ; break;
+	case 1: c_prot = PROT_WRITE; break;
+	case 2: c_prot = PROT_READ|PROT_WRITE; break;
+	default: caml_invalid_argument("protectiontype");
+	}
+
+	if (nr < 1)
+		caml_invalid_argument("frames");
+	if (c_errors->dim[0] != nr)
+		caml_invalid_argument("errors: must be as long as frames");
+
+	/* The frames bigarray can be handed to libxc as is when xen_pfn_t is
+	 * 64-bit; otherwise it needs narrowing first */
+	if (sizeof(xen_pfn_t) != sizeof(int64_t)) {
+		pfns = malloc(nr * sizeof(*pfns));
+		if (!pfns)
+			caml_raise_out_of_memory();
+		for (i = 0; i < nr; i++)
+			pfns[i] = ((int64_t *) c_frames->data)[i];
+	}
+
+	result = alloc_mmap_interface(nr * PAGE_SIZE);
+	xc_blocking_enter();
+	addr = xc_map_foreign_bulk(c_xch, c_dom, c_prot,
+	                           pfns ? pfns : (xen_pfn_t *) c_frames->data,
+	                           (int *) c_errors->data, nr);
+	xc_blocking_leave();
+
+	free(pfns);
+	if (!addr)
+		xc_failwith("xc_map_foreign_bulk error");
+	Intf_val(result)->addr = addr;
 	CAMLreturn(result);
 }
 
@@ -899,14 +3275,16 @@ CAMLprim value stub_sched_credit_domain_get(value xch, value domid)
 {
 	CAMLparam2(xch, domid);
 	CAMLlocal1(sdom);
+	xc_interface *c_xch = _H(xch);
 	struct xen_domctl_sched_credit c_sdom;
 	int ret;
 
-	caml_enter_blocking_section();
-	ret = xc_sched_credit_domain_get(_H(xch), _D(domid), &c_sdom);
-	caml_leave_blocking_section();
+	XC_STAT_OP("sched_credit_domain_get");
+	xc_blocking_enter();
+	ret = xc_sched_credit_domain_get(c_xch, _D(domid), &c_sdom);
+	xc_blocking_leave();
 	if (ret != 0)
-		failwith_xc(_H(xch));
+		failwith_xc(c_xch);
 
 	sdom = caml_alloc_tuple(2);
 	Store_field(sdom, 0, Val_int(c_sdom.weight));
@@ -919,16 +3297,18 @@ CAMLprim value stub_sched_credit_domain_set(value xch, value domid,
                                             value sdom)
 {
 	CAMLparam3(xch, domid, sdom);
+	xc_interface *c_xch = _H(xch);
 	struct xen_domctl_sched_credit c_sdom;
 	int ret;
 
+	XC_STAT_OP("sched_credit_domain_set");
 	c_sdom.weight = Int_val(Field(sdom, 0));
 	c_sdom.cap = Int_val(Field(sdom, 1));
-	caml_enter_blocking_section();
-	ret = xc_sched_credit_domain_set(_H(xch), _D(domid), &c_sdom);
-	caml_leave_blocking_section();
+	xc_blocking_enter();
+	ret = xc_sched_credit_domain_set(c_xch, _D(domid), &c_sdom);
+	xc_blocking_leave();
 	if (ret != 0)
-		failwith_xc(_H(xch));
+		failwith_xc(c_xch);
 
 	CAMLreturn(Val_unit);
 }
@@ -937,16 +3317,18 @@ CAMLprim value stub_shadow_allocation_get(value xch, value domid)
 {
 	CAMLparam2(xch, domid);
 	CAMLlocal1(mb);
+	xc_interface *c_xch = _H(xch);
 	unsigned long c_mb;
 	int ret;
 
-	caml_enter_blocking_section();
-	ret = xc_shadow_control(_H(xch), _D(domid),
+	XC_STAT_OP("shadow_allocation_get");
+	xc_blocking_enter();
+	ret = xc_shadow_control(c_xch, _D(domid),
 				XEN_DOMCTL_SHADOW_OP_GET_ALLOCATION,
 				NULL, 0, &c_mb, 0, NULL);
-	caml_leave_blocking_section();
+	xc_blocking_leave();
 	if (ret != 0)
-		failwith_xc(_H(xch));
+		failwith_xc(c_xch);
 
 	mb = Val_int(c_mb);
 	CAMLreturn(mb);
@@ -956,17 +3338,19 @@ CAMLprim value stub_shadow_allocation_set(value xch, value domid,
 					  value mb)
 {
 	CAMLparam3(xch, domid, mb);
+	xc_interface *c_xch = _H(xch);
 	unsigned long c_mb;
 	int ret;
 
+	XC_STAT_OP("shadow_allocation_set");
 	c_mb = Int_val(mb);
-	caml_enter_blocking_section();
-	ret = xc_shadow_control(_H(xch), _D(domid),
+	xc_blocking_enter();
+	ret = xc_shadow_control(c_xch, _D(domid),
 				XEN_DOMCTL_SHADOW_OP_SET_ALLOCATION,
 				NULL, 0, &c_mb, 0, NULL);
-	caml_leave_blocking_section();
+	xc_blocking_leave();
 	if (ret != 0)
-		failwith_xc(_H(xch));
+		failwith_xc(c_xch);
 
 	CAMLreturn(Val_unit);
 }
@@ -976,18 +3360,24 @@ CAMLprim value stub_xc_domain_ioport_permission(value xch, value domid,
 					       value allow)
 {
 	CAMLparam5(xch, domid, start_port, nr_ports, allow);
-	uint32_t c_start_port, c_nr_ports;
+	xc_interface *c_xch = _H(xch);
+	uint32_t c_domid, c_start_port, c_nr_ports;
 	uint8_t c_allow;
 	int ret;
 
+	XC_STAT_OP("domain_ioport_permission");
 	c_start_port = Int_val(start_port);
 	c_nr_ports = Int_val(nr_ports);
 	c_allow = Bool_val(allow);
 
-	ret = xc_domain_ioport_permission(_H(xch), _D(domid),
+	c_domid = _D(domid);
+
+	xc_blocking_enter();
+	ret = xc_domain_ioport_permission(c_xch, c_domid,
 					 c_start_port, c_nr_ports, c_allow);
+	xc_blocking_leave();
 	if (ret < 0)
-		failwith_xc(_H(xch));
+		failwith_xc(c_xch);
 
 	CAMLreturn(Val_unit);
 }
@@ -997,18 +3387,25 @@ CAMLprim value stub_xc_domain_iomem_permission(value xch, value domid,
 					       value allow)
 {
 	CAMLparam5(xch, domid, start_pfn, nr_pfns, allow);
+	xc_interface *c_xch = _H(xch);
 	unsigned long c_start_pfn, c_nr_pfns;
+	uint32_t c_domid;
 	uint8_t c_allow;
 	int ret;
 
+	XC_STAT_OP("domain_iomem_permission");
 	c_start_pfn = Nativeint_val(start_pfn);
 	c_nr_pfns = Nativeint_val(nr_pfns);
 	c_allow = Bool_val(allow);
 
-	ret = xc_domain_iomem_permission(_H(xch), _D(domid),
+	c_domid = _D(domid);
+
+	xc_blocking_enter();
+	ret = xc_domain_iomem_permission(c_xch, c_domid,
 					 c_start_pfn, c_nr_pfns, c_allow);
+	xc_blocking_leave();
 	if (ret < 0)
-		failwith_xc(_H(xch));
+		failwith_xc(c_xch);
 
 	CAMLreturn(Val_unit);
 }
@@ -1017,17 +3414,24 @@ CAMLprim value stub_xc_domain_irq_permission(value xch, value domid,
 					     value pirq, value allow)
 {
 	CAMLparam4(xch, domid, pirq, allow);
+	xc_interface *c_xch = _H(xch);
+	uint32_t c_domid;
 	uint8_t c_pirq;
 	uint8_t c_allow;
 	int ret;
 
+	XC_STAT_OP("domain_irq_permission");
 	c_pirq = Int_val(pirq);
 	c_allow = Bool_val(allow);
 
-	ret = xc_domain_irq_permission(_H(xch), _D(domid),
+	c_domid = _D(domid);
+
+	xc_blocking_enter();
+	ret = xc_domain_irq_permission(c_xch, c_domid,
 				       c_pirq, c_allow);
+	xc_blocking_leave();
 	if (ret < 0)
-		failwith_xc(_H(xch));
+		failwith_xc(c_xch);
 
 	CAMLreturn(Val_unit);
 }
@@ -1043,20 +3447,28 @@ static uint32_t encode_sbdf(int domain, int bus, int dev, int func)
 CAMLprim value stub_xc_hvm_check_pvdriver(value xch, value domid)
 {
 	CAMLparam2(xch, domid);
+	xc_interface *c_xch = _H(xch);
 	int ret;
 	unsigned long irq = 0;
 	xc_domaininfo_t info;
+	uint32_t c_domid = _D(domid);
 
-	ret = xc_domain_getinfolist(_H(xch), _D(domid), 1, &info);
-	if (ret != 1 || info.domain != _D(domid)) {
-		caml_failwith("Domain does not exist.");
+	XC_STAT_OP("hvm_check_pvdriver");
+	xc_blocking_enter();
+	ret = xc_domain_getinfolist(c_xch, c_domid, 1, &info);
+	if (ret == 1 && info.domain == c_domid &&
+	    (info.flags & XEN_DOMINF_hvm_guest))
+		xc_get_hvm_param(c_xch, c_domid, HVM_PARAM_CALLBACK_IRQ, &irq);
+	xc_blocking_leave();
+
+	if (ret != 1 || info.domain != c_domid) {
+		xc_failwith("Domain does not exist.");
 	}
 
 	if (!(info.flags & XEN_DOMINF_hvm_guest)) {
-		caml_failwith("Domain is not HVM guest.");
+		xc_failwith("Domain is not HVM guest.");
 	}
 
-	xc_get_hvm_param(_H(xch), _D(domid), HVM_PARAM_CALLBACK_IRQ, &irq);
 	if (irq != 0)
 		CAMLreturn(Val_true);
 	else
@@ -1066,17 +3478,22 @@ CAMLprim value stub_xc_hvm_check_pvdriver(value xch, value domid)
 CAMLprim value stub_xc_domain_test_assign_device(value xch, value domid, value desc)
 {
 	CAMLparam3(xch, domid, desc);
+	xc_interface *c_xch = _H(xch);
 	int ret;
 	int domain, bus, dev, func;
+	uint32_t c_domid = _D(domid);
 	uint32_t sbdf;
 
+	XC_STAT_OP("domain_test_assign_device");
 	domain = Int_val(Field(desc, 0));
 	bus = Int_val(Field(desc, 1));
 	dev = Int_val(Field(desc, 2));
 	func = Int_val(Field(desc, 3));
 	sbdf = encode_sbdf(domain, bus, dev, func);
 
-	ret = xc_test_assign_device(_H(xch), _D(domid), sbdf);
+	xc_blocking_enter();
+	ret = xc_test_assign_device(c_xch, c_domid, sbdf);
+	xc_blocking_leave();
 
 	CAMLreturn(Val_bool(ret == 0));
 }
@@ -1084,73 +3501,107 @@ CAMLprim value stub_xc_domain_test_assign_device(value xch, value domid, value d
 CAMLprim value stub_xc_domain_assign_device(value xch, value domid, value desc)
 {
 	CAMLparam3(xch, domid, desc);
+	xc_interface *c_xch = _H(xch);
 	int ret;
 	int domain, bus, dev, func;
+	uint32_t c_domid = _D(domid);
 	uint32_t sbdf;
 
+	XC_STAT_OP("domain_assign_device");
 	domain = Int_val(Field(desc, 0));
 	bus = Int_val(Field(desc, 1));
 	dev = Int_val(Field(desc, 2));
 	func = Int_val(Field(desc, 3));
 	sbdf = encode_sbdf(domain, bus, dev, func);
 
-	ret = xc_assign_device(_H(xch), _D(domid), sbdf
+	xc_blocking_enter();
+	ret = xc_assign_device(c_xch, c_domid, sbdf
 #ifdef HAVE_XEN_4_6
 ,0
 #endif
 );
+	xc_blocking_leave();
 
 	if (ret < 0)
-		failwith_xc(_H(xch));
+		failwith_xc(c_xch);
 	CAMLreturn(Val_unit);
 }
 
 CAMLprim value stub_xc_domain_deassign_device(value xch, value domid, value desc)
 {
 	CAMLparam3(xch, domid, desc);
+	xc_interface *c_xch = _H(xch);
 	int ret;
 	int domain, bus, dev, func;
+	uint32_t c_domid = _D(domid);
 	uint32_t sbdf;
 
+	XC_STAT_OP("domain_deassign_device");
 	domain = Int_val(Field(desc, 0));
 	bus = Int_val(Field(desc, 1));
 	dev = Int_val(Field(desc, 2));
 	func = Int_val(Field(desc, 3));
 	sbdf = encode_sbdf(domain, bus, dev, func);
 
-	ret = xc_deassign_device(_H(xch), _D(domid), sbdf);
+	xc_blocking_enter();
+	ret = xc_deassign_device(c_xch, c_domid, sbdf);
+	xc_blocking_leave();
 
 	if (ret < 0)
-		failwith_xc(_H(xch));
+		failwith_xc(c_xch);
 	CAMLreturn(Val_unit);
 }
 
+#ifdef XEN_SYSCTL_cpu_featureset_raw
+static uint32_t cpu_featureset_len(xc_interface *xch)
+{
+	/* Host-wide constant: racing threads store the same value */
+	static uint32_t fs_len;
+	uint32_t max_len = __atomic_load_n(&fs_len, __ATOMIC_RELAXED);
+
+	if (max_len == 0)
+	{
+		struct xc_stat *op = xc_stat_op;
+		int ret;
+
+		xc_blocking_enter();
+		ret = xc_get_cpu_featureset(xch, 0, &max_len, NULL);
+		xc_blocking_leave();
+		/* The stub's own call follows */
+		xc_stats_set_op(op);
+
+		if (ret || (max_len == 0))
+			failwith_xc(xch);
+		__atomic_store_n(&fs_len, max_len, __ATOMIC_RELAXED);
+	}
+	return max_len;
+}
+#endif
+
 CAMLprim value stub_xc_get_cpu_featureset(value xch, value idx)
 {
 	CAMLparam2(xch, idx);
 	CAMLlocal1(bitmap_val);
+	xc_interface *c_xch = _H(xch);
 
 #ifdef XEN_SYSCTL_cpu_featureset_raw
-	/* Safe, because of the global ocaml lock. */
-	static uint32_t fs_len;
-
-	if (fs_len == 0)
-	{
-		int ret = xc_get_cpu_featureset(_H(xch), 0, &fs_len, NULL);
-
-		if (ret || (fs_len == 0))
-			failwith_xc(_H(xch));
-	}
+	uint32_t max_len;
 
+	XC_STAT_OP("get_cpu_featureset");
+	max_len = cpu_featureset_len(c_xch);
 	{
 		/* To/from hypervisor to retrieve actual featureset */
-		uint32_t fs[fs_len], len = fs_len;
+		uint32_t fs[max_len], len = max_len;
+		uint32_t c_idx = Int_val(idx);
 		unsigned int i;
+		int ret;
 
-		int ret = xc_get_cpu_featureset(_H(xch), Int_val(idx), &len, fs);
+		xc_blocking_enter();
+		ret = xc_get_cpu_featureset(c_xch, c_idx, &len, fs);
+		xc_blocking_leave();
 
 		if (ret)
-			failwith_xc(_H(xch));
+			failwith_xc(c_xch);
 
 		bitmap_val = caml_alloc(len, 0);
 
@@ -1168,6 +3619,7 @@ CAMLprim value stub_upgrade_oldstyle_featuremask(
 {
 	CAMLparam3(xch, oldmask, is_hvm);
 	CAMLlocal1(featureset);
+	xc_interface *c_xch = _H(xch);
 
 #ifdef XEN_SYSCTL_cpu_featureset_raw
 	uint32_t fs[4];
@@ -1179,23 +3631,29 @@ CAMLprim value stub_upgrade_oldstyle_featuremask(
 	};
 
 	/*
-	 * Safe, because of the global ocaml lock.  We cache the first 4 words
-	 * of the host pv and hvm featuresets.
+	 * We cache the first 4 words of the host pv and hvm featuresets.
+	 * The mask is fetched into a local copy and published with a release
+	 * store, so that the cache is safe without the global ocaml lock.
 	 */
 	static struct cached_mask cache[2];
 	struct cached_mask *cached = &cache[!!Bool_val(is_hvm)];
 
-	if ( !cached->initialised )
+	XC_STAT_OP("upgrade_oldstyle_featuremask");
+	if ( !__atomic_load_n(&cached->initialised, __ATOMIC_ACQUIRE) )
 	{
 		int idx = Bool_val(is_hvm) ?
 			XEN_SYSCTL_cpu_featureset_hvm : XEN_SYSCTL_cpu_featureset_pv;
-		uint32_t len = 4;
+		uint32_t len = 4, mask[4] = { 0 };
+		int ret;
 
-		int ret = xc_get_cpu_featureset(_H(xch), idx, &len, cached->mask);
+		xc_blocking_enter();
+		ret = xc_get_cpu_featureset(c_xch, idx, &len, mask);
+		xc_blocking_leave();
 
 		if ( ret && errno != ENOBUFS )
-			failwith_xc(_H(xch));
-		cached->initialised = true;
+			failwith_xc(c_xch);
+		memcpy(cached->mask, mask, sizeof(mask));
+		__atomic_store_n(&cached->initialised, true, __ATOMIC_RELEASE);
 	}
 
 	/*
@@ -1229,21 +3687,29 @@ CAMLprim value stub_oldstyle_featuremask(value xch)
 {
 	CAMLparam1(xch);
 	CAMLlocal1(oldmask);
+	xc_interface *c_xch = _H(xch);
 
 #ifdef XEN_SYSCTL_cpu_featureset_raw
-	/* Safe, because of the global ocaml lock. */
+	/* Published with a release store, see stub_upgrade_oldstyle_featuremask */
 	static uint32_t fs[4];
 	static bool have_fs;
 
-	if (!have_fs)
+	XC_STAT_OP("oldstyle_featuremask");
+	if (!__atomic_load_n(&have_fs, __ATOMIC_ACQUIRE))
 	{
 		unsigned int len = 4;
-		int ret = xc_get_cpu_featureset(
-			_H(xch), XEN_SYSCTL_cpu_featureset_raw, &len, fs);
+		uint32_t raw[4] = { 0 };
+		int ret;
+
+		xc_blocking_enter();
+		ret = xc_get_cpu_featureset(
+			c_xch, XEN_SYSCTL_cpu_featureset_raw, &len, raw);
+		xc_blocking_leave();
 
 		if (ret && (errno != ENOBUFS))
-			failwith_xc(_H(xch));
-		have_fs = true;
+			failwith_xc(c_xch);
+		memcpy(fs, raw, sizeof(raw));
+		__atomic_store_n(&have_fs, true, __ATOMIC_RELEASE);
 	}
 
 	/*
@@ -1262,15 +3728,178 @@ CAMLprim value stub_oldstyle_featuremask(value xch)
 	CAMLreturn(oldmask);
 }
 
+/*
+ * Featuresets packed as uint32 words in an int32 bigarray. The loops are
+ * kept simple so that the compiler vectorises them.
+ */
+#define Featureset_data(v) ((uint32_t *) Caml_ba_data_val(v))
+#define Featureset_len(v) ((uintnat) Caml_ba_array_val(v)->dim[0])
+
+static value alloc_featureset(uintnat len)
+{
+	return caml_ba_alloc_dims(CAML_BA_INT32 | CAML_BA_C_LAYOUT, 1, NULL,
+	                          (intnat) len);
+}
+
+CAMLprim value stub_xc_get_cpu_featureset_packed(value xch, value idx)
+{
+	CAMLparam2(xch, idx);
+	CAMLlocal1(result);
+	xc_interface *c_xch = _H(xch);
+
+#ifdef XEN_SYSCTL_cpu_featureset_raw
+	uint32_t max_len;
+
+	XC_STAT_OP("get_cpu_featureset_packed");
+	max_len = cpu_featureset_len(c_xch);
+	{
+		uint32_t fs[max_len], len = max_len;
+		uint32_t c_idx = Int_val(idx);
+		int ret;
+
+		xc_blocking_enter();
+		ret = xc_get_cpu_featureset(c_xch, c_idx, &len, fs);
+		xc_blocking_leave();
+
+		if (ret)
+			failwith_xc(c_xch);
+
+		result = alloc_featureset(len);
+		memcpy(Featureset_data(result), fs, len * sizeof(*fs));
+	}
+#else
+	caml_failwith("xc_get_cpu_featureset: Not implemented");
+#endif
+	CAMLreturn(result);
+}
+
+CAMLprim value stub_featureset_inter(value a, value b)
+{
+	CAMLparam2(a, b);
+	CAMLlocal1(result);
+	uintnat la = Featureset_len(a), lb = Featureset_len(b);
+	uintnat n = la < lb ? la : lb, i;
+	const uint32_t *pa, *pb;
+	uint32_t *r;
+
+	result = alloc_featureset(n);
+	pa = Featureset_data(a);
+	pb = Featureset_data(b);
+	r = Featureset_data(result);
+	for (i = 0; i < n; i++)
+		r[i] = pa[i] & pb[i];
+	CAMLreturn(result);
+}
+
+CAMLprim value stub_featureset_union(value a, value b)
+{
+	CAMLparam2(a, b);
+	CAMLlocal1(result);
+	uintnat la = Featureset_len(a), lb = Featureset_len(b);
+	uintnat n = la < lb ? la : lb, i;
+	const uint32_t *pa, *pb;
+	uint32_t *r;
+
+	result = alloc_featureset(la > lb ? la : lb);
+	pa = Featureset_data(a);
+	pb = Featureset_data(b);
+	r = Featureset_data(result);
+	for (i = 0; i < n; i++)
+		r[i] = pa[i] | pb[i];
+	if (la > n)
+		memcpy(r + n, pa + n, (la - n) * sizeof(*r));
+	else if (lb > n)
+		memcpy(r + n, pb + n, (lb - n) * sizeof(*r));
+	CAMLreturn(result);
+}
+
+CAMLprim value stub_featureset_diff(value a, value b)
+{
+	CAMLparam2(a, b);
+	CAMLlocal1(result);
+	uintnat la = Featureset_len(a), lb = Featureset_len(b);
+	uintnat n = la < lb ? la : lb, i;
+	const uint32_t *pa, *pb;
+	uint32_t *r;
+
+	result = alloc_featureset(la);
+	pa = Featureset_data(a);
+	pb = Featureset_data(b);
+	r = Featureset_data(result);
+	for (i = 0; i < n; i++)
+		r[i] = pa[i] & ~pb[i];
+	if (la > n)
+		memcpy(r + n, pa + n, (la - n) * sizeof(*r));
+	CAMLreturn(result);
+}
+
+CAMLprim value stub_featureset_subset(value a, value b)
+{
+	uintnat la = Featureset_len(a), lb = Featureset_len(b);
+	uintnat n = la < lb ? la : lb, i;
+	const uint32_t *pa = Featureset_data(a), *pb = Featureset_data(b);
+	uint32_t extra = 0;
+
+	for (i = 0; i < n; i++)
+		extra |= pa[i] & ~pb[i];
+	for (; i < la; i++)
+		extra |= pa[i];
+	return Val_bool(extra == 0);
+}
+
+CAMLprim value stub_featureset_popcount(value a)
+{
+	uintnat la = Featureset_len(a), i;
+	const uint32_t *pa = Featureset_data(a);
+	intnat count = 0;
+
+	for (i = 0; i < la; i++)
+		count += __builtin_popcount(pa[i]);
+	return Val_long(count);
+}
+
+CAMLprim value stub_featureset_level(value sets)
+{
+	CAMLparam1(sets);
+	CAMLlocal1(result);
+	mlsize_t nr = Wosize_val(sets), j;
+	uintnat n, i;
+	uint32_t *r;
+
+	if (nr == 0)
+		caml_invalid_argument("featureset_level");
+
+	n = Featureset_len(Field(sets, 0));
+	for (j = 1; j < nr; j++)
+		if (Featureset_len(Field(sets, j)) < n)
+			n = Featureset_len(Field(sets, j));
+
+	result = alloc_featureset(n);
+	r = Featureset_data(result);
+	memcpy(r, Featureset_data(Field(sets, 0)), n * sizeof(*r));
+	for (j = 1; j < nr; j++) {
+		const uint32_t *p = Featureset_data(Field(sets, j));
+
+		for (i = 0; i < n; i++)
+			r[i] &= p[i];
+	}
+	CAMLreturn(result);
+}
+
 CAMLprim value stub_xc_watchdog(value xch, value domid, value timeout)
 {
 	CAMLparam3(xch, domid, timeout);
+	xc_interface *c_xch = _H(xch);
 	int ret;
+	uint32_t c_domid = _D(domid);
 	unsigned int c_timeout = Int32_val(timeout);
 
-	ret = xc_watchdog(_H(xch), _D(domid), c_timeout);
+	XC_STAT_OP("watchdog");
+	xc_blocking_enter();
+	ret = xc_watchdog(c_xch, c_domid, c_timeout);
+	xc_blocking_leave();
 	if (ret < 0)
-		failwith_xc(_H(xch));
+		failwith_xc(c_xch);
 
 	CAMLreturn(Val_int(ret));
 }
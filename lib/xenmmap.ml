@@ -22,10 +22,20 @@ type mmap_map_flag = SHARED | PRIVATE
 (* mmap: fd -> prot_flag -> map_flag -> length -> offset -> interface *)
 external mmap: Unix.file_descr -> mmap_prot_flag -> mmap_map_flag
 		-> int -> int -> mmap_interface = "stub_mmap_init"
+
+type mmap_option = POPULATE | HUGEPAGE | SEQUENTIAL | LOCKED
+
+(* mmap_with_options: same as mmap, with extra options *)
+external mmap_with_options: Unix.file_descr -> mmap_prot_flag -> mmap_map_flag
+		-> int -> int -> mmap_option list -> mmap_interface
+		= "stub_mmap_init_opts_byte" "stub_mmap_init_opts"
 external unmap: mmap_interface -> unit = "stub_mmap_final"
 (* read: interface -> start -> length -> data *)
 external read: mmap_interface -> int -> int -> string = "stub_mmap_read"
 (* write: interface -> data -> start -> length -> unit *)
 external write: mmap_interface -> string -> int -> int -> unit = "stub_mmap_write"
+(* to_bigarray: interface -> in-place view of the whole mapping *)
+type mmap_bigarray = (char, Bigarray.int8_unsigned_elt, Bigarray.c_layout) Bigarray.Array1.t
+external to_bigarray: mmap_interface -> mmap_bigarray = "stub_mmap_to_bigarray"
 (* getpagesize: unit -> size of page *)
 external getpagesize: unit -> int = "stub_mmap_getpagesize"
@@ -20,9 +20,40 @@ type mmap_map_flag = SHARED | PRIVATE
 
 external mmap : Unix.file_descr -> mmap_prot_flag -> mmap_map_flag -> int -> int
              -> mmap_interface = "stub_mmap_init"
+
+type mmap_option =
+  | POPULATE   (** prefault the whole mapping ([MAP_POPULATE]) *)
+  | HUGEPAGE   (** back it with transparent huge pages ([MADV_HUGEPAGE]) *)
+  | SEQUENTIAL (** read ahead aggressively ([MADV_SEQUENTIAL]) *)
+  | LOCKED     (** lock it in memory ([mlock]) *)
+
+external mmap_with_options : Unix.file_descr -> mmap_prot_flag -> mmap_map_flag
+                          -> int -> int -> mmap_option list -> mmap_interface
+                          = "stub_mmap_init_opts_byte" "stub_mmap_init_opts"
+(** [mmap_with_options fd prot flags len offset options] is [mmap fd
+    prot flags len offset] with [options] applied. Lengths and offsets
+    are 64-bit on 64-bit hosts. [HUGEPAGE] and [SEQUENTIAL] are advice
+    and silently ignored where unsupported. If [LOCKED] cannot be
+    honoured, nothing is left mapped and [Failure] is raised, naming the
+    option and the reason. *)
+
 external unmap : mmap_interface -> unit = "stub_mmap_final"
+(** [unmap intf] releases the mapping now, or, if views of it made by
+    [to_bigarray] are still alive, once they are collected. It is
+    idempotent; a mapping which is never unmapped is released when
+    [intf] and its views are garbage collected, and its size is
+    accounted to the GC so that it paces itself. *)
 external read : mmap_interface -> int -> int -> string = "stub_mmap_read"
 external write : mmap_interface -> string -> int -> int -> unit
                = "stub_mmap_write"
 
+type mmap_bigarray = (char, Bigarray.int8_unsigned_elt, Bigarray.c_layout) Bigarray.Array1.t
+(** Same type as [Cstruct.buffer], so [Cstruct.of_bigarray] can wrap it. *)
+
+external to_bigarray : mmap_interface -> mmap_bigarray = "stub_mmap_to_bigarray"
+(** [to_bigarray intf] is a view of the whole mapping, read and written
+    in place without copying. A view, and any sub-array of it, keeps the
+    mapping alive: [unmap intf] only drops the reference of [intf], and
+    the pages are released once [intf] and all its views are gone. *)
+
 external getpagesize : unit -> int = "stub_mmap_getpagesize"
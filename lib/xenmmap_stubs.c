@@ -15,6 +15,7 @@
  */
 
 #include <unistd.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <sys/mman.h>
 #include <string.h>
@@ -27,24 +28,95 @@
 #include <caml/custom.h>
 #include <caml/fail.h>
 #include <caml/callback.h>
+#include <caml/signals.h>
+#include <caml/bigarray.h>
+#include <caml/version.h>
 
-#define Intf_val(a) ((struct mmap_interface *) a)
+/* Before 4.10, sub-arrays of a view would not inherit its finalizer, so
+ * their share of the mapping would never be dropped */
+#if OCAML_VERSION_MAJOR < 4 || \
+    (OCAML_VERSION_MAJOR == 4 && OCAML_VERSION_MINOR < 10)
+#error "Xenmmap needs OCaml 4.10 or later"
+#endif
 
-static int mmap_interface_init(struct mmap_interface *intf,
-                               int fd, int pflag, int mflag,
-                               int len, int offset)
+/* A mapping is owned by its interface and by every bigarray view of it.
+ * The first view moves it into a proxy which counts the owners, as the
+ * runtime does for sub-arrays; the last owner to go unmaps it. */
+#if OCAML_VERSION_MAJOR >= 5
+#define Proxy_incr(p) atomic_fetch_add(&(p)->refcount, 1)
+#define Proxy_decr(p) (atomic_fetch_sub(&(p)->refcount, 1) - 1)
+#else
+#define Proxy_incr(p) (++(p)->refcount)
+#define Proxy_decr(p) (--(p)->refcount)
+#endif
+
+static void mmap_proxy_release(struct caml_ba_proxy *proxy)
 {
-	intf->len = len;
-	intf->addr = mmap(NULL, len, pflag, mflag, fd, offset);
-	return (intf->addr == MAP_FAILED) ? errno : 0;
+	if (Proxy_decr(proxy) == 0) {
+		munmap(proxy->data, proxy->size);
+		free(proxy);
+	}
 }
 
-CAMLprim value stub_mmap_init(value fd, value pflag, value mflag,
-                              value len, value offset)
+static void mmap_interface_release(struct mmap_interface *intf)
+{
+	if (intf->addr == MAP_FAILED)
+		return;
+
+	if (intf->proxy)
+		mmap_proxy_release(intf->proxy);
+	else
+		munmap(intf->addr, intf->len);
+	intf->addr = MAP_FAILED;
+	intf->proxy = NULL;
+}
+
+static void mmap_interface_finalize(value intf)
+{
+	mmap_interface_release(Intf_val(intf));
+}
+
+static struct custom_operations mmap_interface_ops = {
+	"xenmmap.mmap_interface",
+	mmap_interface_finalize,
+	custom_compare_default,
+	custom_hash_default,
+	custom_serialize_default,
+	custom_deserialize_default,
+	custom_compare_ext_default,
+};
+
+value alloc_mmap_interface(size_t len)
+{
+	CAMLparam0();
+	CAMLlocal1(result);
+
+	result = caml_alloc_custom_mem(&mmap_interface_ops,
+	                               sizeof(struct mmap_interface), len);
+	Intf_val(result)->addr = MAP_FAILED;
+	Intf_val(result)->len = len;
+	Intf_val(result)->proxy = NULL;
+
+	CAMLreturn(result);
+}
+
+/* Constructors of Xenmmap.mmap_option */
+#define MMAP_OPT_POPULATE   0
+#define MMAP_OPT_HUGEPAGE   1
+#define MMAP_OPT_SEQUENTIAL 2
+#define MMAP_OPT_LOCKED     3
+
+static value mmap_init(value fd, value pflag, value mflag,
+                       value len, value offset, value options)
 {
 	CAMLparam5(fd, pflag, mflag, len, offset);
+	CAMLxparam1(options);
 	CAMLlocal1(result);
-	int c_pflag, c_mflag;
+	int c_pflag, c_mflag, c_fd = Int_val(fd);
+	int hugepage = 0, sequential = 0, locked = 0, err = 0;
+	intnat c_len = Long_val(len), c_offset = Long_val(offset);
+	void *addr;
+	value l;
 
 	switch (Int_val(pflag)) {
 	case 0: c_pflag = PROT_READ; break;
@@ -59,22 +131,83 @@ CAMLprim value stub_mmap_init(value fd, value pflag, value mflag,
 	default: caml_invalid_argument("maptype");
 	}
 
-	result = caml_alloc(sizeof(struct mmap_interface), Abstract_tag);
+	if (c_len <= 0)
+		caml_invalid_argument("len");
+	if (c_offset < 0)
+		caml_invalid_argument("offset");
+
+	for (l = options; l != Val_emptylist; l = Field(l, 1)) {
+		switch (Int_val(Field(l, 0))) {
+		case MMAP_OPT_POPULATE:
+#ifdef MAP_POPULATE
+			c_mflag |= MAP_POPULATE;
+#endif
+			break;
+		case MMAP_OPT_HUGEPAGE: hugepage = 1; break;
+		case MMAP_OPT_SEQUENTIAL: sequential = 1; break;
+		case MMAP_OPT_LOCKED: locked = 1; break;
+		}
+	}
+
+	/* Allocated first, so that nothing can raise once we have mapped */
+	result = alloc_mmap_interface(c_len);
 
-	if (mmap_interface_init(Intf_val(result), Int_val(fd),
-	                        c_pflag, c_mflag,
-	                        Int_val(len), Int_val(offset)))
+	/* Prefaulting or locking a large mapping can take a while */
+	caml_enter_blocking_section();
+	addr = mmap(NULL, c_len, c_pflag, c_mflag, c_fd, (off_t) c_offset);
+	if (addr != MAP_FAILED) {
+		/* Advice is best effort: THP may well be disabled */
+#ifdef MADV_HUGEPAGE
+		if (hugepage)
+			madvise(addr, c_len, MADV_HUGEPAGE);
+#endif
+		if (sequential)
+			madvise(addr, c_len, MADV_SEQUENTIAL);
+		if (locked && mlock(addr, c_len)) {
+			err = errno;
+			munmap(addr, c_len);
+			addr = MAP_FAILED;
+		}
+	}
+	caml_leave_blocking_section();
+
+	/* The mapping was undone above, so there is nothing to release */
+	if (err) {
+		char msg[128];
+
+		snprintf(msg, sizeof(msg), "mmap: LOCKED: mlock: %s",
+		         strerror(err));
+		caml_failwith(msg);
+	}
+	if (addr == MAP_FAILED)
 		caml_failwith("mmap");
+
+	Intf_val(result)->addr = addr;
 	CAMLreturn(result);
 }
 
+CAMLprim value stub_mmap_init(value fd, value pflag, value mflag,
+                              value len, value offset)
+{
+	return mmap_init(fd, pflag, mflag, len, offset, Val_emptylist);
+}
+
+CAMLprim value stub_mmap_init_opts(value fd, value pflag, value mflag,
+                                   value len, value offset, value options)
+{
+	return mmap_init(fd, pflag, mflag, len, offset, options);
+}
+
+CAMLprim value stub_mmap_init_opts_byte(value *argv, int argn)
+{
+	return mmap_init(argv[0], argv[1], argv[2], argv[3], argv[4], argv[5]);
+}
+
 CAMLprim value stub_mmap_final(value intf)
 {
 	CAMLparam1(intf);
 
-	if (Intf_val(intf)->addr != MAP_FAILED)
-		munmap(Intf_val(intf)->addr, Intf_val(intf)->len);
-	Intf_val(intf)->addr = MAP_FAILED;
+	mmap_interface_release(Intf_val(intf));
 
 	CAMLreturn(Val_unit);
 }
@@ -83,15 +216,17 @@ CAMLprim value stub_mmap_read(value intf, value start, value len)
 {
 	CAMLparam3(intf, start, len);
 	CAMLlocal1(data);
-	int c_start;
-	int c_len;
+	intnat c_start;
+	intnat c_len;
 
-	c_start = Int_val(start);
-	c_len = Int_val(len);
+	c_start = Long_val(start);
+	c_len = Long_val(len);
 
-	if (c_start > Intf_val(intf)->len)
+	if (Intf_val(intf)->addr == MAP_FAILED)
+		caml_invalid_argument("mapping unmapped");
+	if (c_start < 0 || c_start > Intf_val(intf)->len)
 		caml_invalid_argument("start invalid");
-	if (c_start + c_len > Intf_val(intf)->len)
+	if (c_len < 0 || c_len > Intf_val(intf)->len - c_start)
 		caml_invalid_argument("len invalid");
 
 	data = caml_alloc_string(c_len);
@@ -104,15 +239,17 @@ CAMLprim value stub_mmap_write(value intf, value data,
                                value start, value len)
 {
 	CAMLparam4(intf, data, start, len);
-	int c_start;
-	int c_len;
+	intnat c_start;
+	intnat c_len;
 
-	c_start = Int_val(start);
-	c_len = Int_val(len);
+	c_start = Long_val(start);
+	c_len = Long_val(len);
 
-	if (c_start > Intf_val(intf)->len)
+	if (Intf_val(intf)->addr == MAP_FAILED)
+		caml_invalid_argument("mapping unmapped");
+	if (c_start < 0 || c_start > Intf_val(intf)->len)
 		caml_invalid_argument("start invalid");
-	if (c_start + c_len > Intf_val(intf)->len)
+	if (c_len < 0 || c_len > Intf_val(intf)->len - c_start)
 		caml_invalid_argument("len invalid");
 
 	memcpy(Intf_val(intf)->addr + c_start, (char *) data, c_len);
@@ -120,6 +257,75 @@ CAMLprim value stub_mmap_write(value intf, value data,
 	CAMLreturn(Val_unit);
 }
 
+/* Views are bigarrays with a finalizer of their own, which drops their
+ * reference to the proxy */
+static void mmap_view_finalize(value v)
+{
+	struct caml_ba_array *b = Caml_ba_array_val(v);
+
+	if (b->proxy)
+		mmap_proxy_release(b->proxy);
+}
+
+static int mmap_view_compare(value v1, value v2)
+{
+	struct caml_ba_array *b1 = Caml_ba_array_val(v1);
+	struct caml_ba_array *b2 = Caml_ba_array_val(v2);
+	int r;
+
+	if (b1->dim[0] != b2->dim[0])
+		return b1->dim[0] < b2->dim[0] ? -1 : 1;
+	r = memcmp(b1->data, b2->data, b1->dim[0]);
+	return (r > 0) - (r < 0);
+}
+
+static struct custom_operations mmap_view_ops = {
+	"xenmmap.view",
+	mmap_view_finalize,
+	mmap_view_compare,
+	custom_hash_default,
+	custom_serialize_default,
+	custom_deserialize_default,
+	custom_compare_ext_default,
+};
+
+CAMLprim value stub_mmap_to_bigarray(value intf)
+{
+	CAMLparam1(intf);
+	CAMLlocal1(result);
+	struct mmap_interface *i = Intf_val(intf);
+	struct caml_ba_proxy *proxy;
+	struct caml_ba_array *b;
+
+	if (i->addr == MAP_FAILED)
+		caml_invalid_argument("mapping unmapped");
+
+	if (!i->proxy) {
+		proxy = malloc(sizeof(*proxy));
+		if (!proxy)
+			caml_raise_out_of_memory();
+		proxy->refcount = 1;
+		proxy->data = i->addr;
+		proxy->size = i->len;
+		i->proxy = proxy;
+	}
+
+	result = caml_alloc_custom(&mmap_view_ops,
+	                           sizeof(struct caml_ba_array) + sizeof(intnat),
+	                           0, 1);
+	i = Intf_val(intf);
+	b = Caml_ba_array_val(result);
+	b->data = i->addr;
+	b->num_dims = 1;
+	/* Not EXTERNAL, so that sub-arrays share the proxy too */
+	b->flags = CAML_BA_CHAR | CAML_BA_C_LAYOUT | CAML_BA_MAPPED_FILE;
+	b->proxy = i->proxy;
+	b->dim[0] = i->len;
+	Proxy_incr(i->proxy);
+
+	CAMLreturn(result);
+}
+
 CAMLprim value stub_mmap_getpagesize(value unit)
 {
 	CAMLparam1(unit);
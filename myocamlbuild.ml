@@ -1,5 +1,5 @@
 (* OASIS_START *)
-(* DO NOT EDIT (digest: a6311a0bd87466a3f1d88bef3d040319) *)
+(* DO NOT EDIT (digest: a2e76d1cb3163d0cf087e6621a8d8834) *)
 module OASISGettext = struct
 (* # 22 "src/oasis/OASISGettext.ml" *)
 
@@ -924,13 +924,21 @@ let package_default =
                       A "-cclib";
                       A "-lxenguest";
                       A "-cclib";
-                      A "-lxenstore"
+                      A "-lxenstore";
+                      A "-cclib";
+                      A "-lpthread"
                    ])
             ]);
           (["oasis_library_xenctrl_cclib"; "ocamlmklib"; "c"],
             [
                (OASISExpr.EBool true,
-                 S [A "-lxenctrl"; A "-lxenguest"; A "-lxenstore"])
+                 S
+                   [
+                      A "-lxenctrl";
+                      A "-lxenguest";
+                      A "-lxenstore";
+                      A "-lpthread"
+                   ])
             ]);
           (["oasis_library_xentoollog_ccopt"; "compile"],
             [
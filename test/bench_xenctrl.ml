@@ -0,0 +1,300 @@
+(* Measures the cost of Xenctrl calls: wall-clock time and words allocated
+   on the OCaml heap per call. Run it against test/fake_xenctrl.c to
+   measure the bindings alone, without a Xen host:
+
+     LD_PRELOAD=./fake_xenctrl.so ./bench_xenctrl.native [iterations] [mode]
+
+   where mode is
+     all      every call the fake supports (the default)
+     scaling  only the calls whose cost grows with the number of domains,
+              to be run at several XC_FAKE_DOMAINS ('make bench-scaling')
+     stall    for each call, the worst delay of another OCaml thread while
+              it runs, to be run with XC_FAKE_LATENCY_NS set: a call which
+              keeps the runtime lock over its hypercall delays the other
+              thread by the whole latency ('make bench-stall')
+
+   Not covered, as the fake does not implement them:
+   domain_assign/deassign/test_assign_device, domain_cpuid_set,
+   domain_cpuid_apply_policy. domain_create,
+   domain_create_full, domain_destroy and domain_destroy_many are not
+   covered either: the fake has room for few new domains, and a domain
+   cannot be destroyed twice. *)
+
+let iterations =
+  try int_of_string Sys.argv.(1) with _ -> 10000
+
+let mode =
+  try Sys.argv.(2) with _ -> "all"
+
+let bench name f =
+  match f () with
+  | exception e ->
+    Printf.printf "%-36s %s\n%!" name (Printexc.to_string e)
+  | _ ->
+    let n = float_of_int iterations in
+    let w0 = Gc.minor_words () in
+    let t0 = Unix.gettimeofday () in
+    for _ = 1 to iterations do ignore (f ()) done;
+    let t1 = Unix.gettimeofday () in
+    let w1 = Gc.minor_words () in
+    Printf.printf "%-36s %12.0f ns/op %10.1f words/op\n%!"
+      name ((t1 -. t0) *. 1e9 /. n) ((w1 -. w0) /. n)
+
+(* Throughput of pooled handles around a hypercall, from 1 to 16 threads
+   sharing a pool of 8. Beyond 8 threads checkouts overflow to unpooled
+   handles. XC_FAKE_LATENCY_NS sets the time spent in the hypercall, during
+   which the runtime lock is released. *)
+let bench_pool_contention () =
+  let pool = Xenctrl.handle_pool_create 8 in
+  List.iter (fun nr_threads ->
+    let per_thread = max 1 (iterations / nr_threads) in
+    let worker () =
+      for _ = 1 to per_thread do
+        Xenctrl.with_pool_intf pool (fun xc ->
+          ignore (Xenctrl.domain_getinfo xc 0))
+      done in
+    let t0 = Unix.gettimeofday () in
+    let threads = Array.init nr_threads (fun _ -> Thread.create worker ()) in
+    Array.iter Thread.join threads;
+    let t1 = Unix.gettimeofday () in
+    let ops = float_of_int (per_thread * nr_threads) in
+    Printf.printf "%-36s %12.0f ns/op %10.0f ops/s\n%!"
+      (Printf.sprintf "with_pool_intf, %d threads" nr_threads)
+      ((t1 -. t0) *. 1e9 /. ops) (ops /. (t1 -. t0))
+  ) [1; 2; 4; 8; 16]
+
+(* The worst delay, beyond its period, of a thread which sleeps for 1ms
+   at a time while [f] runs in a loop *)
+let stall name f =
+  match f () with
+  | exception e ->
+    Printf.printf "%-36s %s\n%!" name (Printexc.to_string e)
+  | () ->
+    let period = 0.001 in
+    let stop = ref false and worst = ref 0. in
+    let ticker () =
+      while not !stop do
+        let t0 = Unix.gettimeofday () in
+        Thread.delay period;
+        worst := max !worst (Unix.gettimeofday () -. t0 -. period)
+      done in
+    let t = Thread.create ticker () in
+    for _ = 1 to iterations do f () done;
+    stop := true;
+    Thread.join t;
+    Printf.printf "%-36s %12.0f us worst tick delay\n%!" name (!worst *. 1e6)
+
+(* Every call, as (name, grows with the number of domains, call). Calls on
+   a single domain use domid 1, which is an HVM guest in the fake. *)
+let calls xc =
+  let physinfo = Xenctrl.physinfo xc in
+  let nr_cpus = physinfo.Xenctrl.nr_cpus in
+  let snapshot = Xenctrl.domaininfo_snapshot_create 4096 in
+  let tracker = Xenctrl.domain_tracker_create () in
+  let watcher = Xenctrl.domain_watcher_create () in
+  let uuids = Xenctrl.uuid_index_create () in
+  let map_cache = Xenctrl.foreign_map_cache_create 16 in
+  let runstates = Xenctrl.runstate_matrix_create 4096 in
+  let runstate_sampler = Xenctrl.runstate_sampler_create () in
+  let busy = Xenctrl.pcpu_busy_create nr_cpus in
+  let pcpu_sampler = Xenctrl.pcpu_sampler_create nr_cpus in
+  let console = Xenctrl.console_reader_create 16384 in
+  let console_buf = Bytes.create 16384 in
+  let console_line = "(XEN) fake console line\n" in
+  let pool = Xenctrl.handle_pool_create 4 in
+  let domids = Array.init 16 (fun i -> i + 1) in
+  let frames = Bigarray.(Array1.create int64 c_layout 16) in
+  let frame_errors = Bigarray.(Array1.create int32 c_layout 16) in
+  let cpumap = Xenctrl.cpumap_create xc in
+  let affinity = Array.make nr_cpus true in
+  let oldmask = [| -1L; -1L; -1L; -1L |] in
+  let all_domids () =
+    Array.of_list (List.filter (( <> ) 0)
+      (List.map (fun i -> i.Xenctrl.domid) (Xenctrl.domain_getinfolist xc 0))) in
+  let call name f = name, false, (fun () -> ignore (f ())) in
+  let scaling name f = name, true, (fun () -> ignore (f ())) in
+  Array.iteri (fun i _ -> Xenctrl.cpumap_set cpumap i) affinity;
+  for i = 0 to 15 do frames.{i} <- Int64.of_int i done;
+  [
+    call "interface_open + interface_close" (fun () ->
+      Xenctrl.interface_close (Xenctrl.interface_open ()));
+    call "handle_pool checkout/return" (fun () ->
+      Xenctrl.handle_pool_return pool (Xenctrl.handle_pool_checkout pool));
+    call "physinfo" (fun () -> Xenctrl.physinfo xc);
+    call "pcpu_info" (fun () -> Xenctrl.pcpu_info xc nr_cpus);
+    call "pcpu_sample" (fun () -> Xenctrl.pcpu_sample xc pcpu_sampler busy);
+    call "version" (fun () -> Xenctrl.version xc);
+    call "version_compile_info" (fun () -> Xenctrl.version_compile_info xc);
+    call "version_changeset" (fun () -> Xenctrl.version_changeset xc);
+    call "version_capabilities" (fun () -> Xenctrl.version_capabilities xc);
+    call "sched_id" (fun () -> Xenctrl.sched_id xc);
+    call "cpumap_size" (fun () -> Xenctrl.cpumap_size xc);
+
+    call "domain_getinfo" (fun () -> Xenctrl.domain_getinfo xc 0);
+    call "domain_getinfo_result" (fun () -> Xenctrl.domain_getinfo_result xc 0);
+    call "domain_exists" (fun () -> Xenctrl.domain_exists xc 1);
+    scaling "domain_getinfolist" (fun () -> Xenctrl.domain_getinfolist xc 0);
+    scaling "domain_getinfolist_result" (fun () ->
+      Xenctrl.domain_getinfolist_result xc 0);
+    scaling "domain_getinfolist_array" (fun () ->
+      Xenctrl.domain_getinfolist_array xc 0);
+    scaling "domain_getinfolist_snapshot" (fun () ->
+      Xenctrl.domain_getinfolist_snapshot xc 0 snapshot);
+    scaling "domain_getinfo_changes" (fun () ->
+      Xenctrl.domain_getinfo_changes xc tracker);
+    scaling "domain_watcher_changes" (fun () ->
+      Xenctrl.domain_watcher_changes xc watcher);
+    scaling "domain_getinfolist + uuid_index_update" (fun () ->
+      Xenctrl.uuid_index_update uuids (Xenctrl.domain_getinfolist_array xc 0));
+
+    call "domain_max_vcpus" (fun () -> Xenctrl.domain_max_vcpus xc 1 4);
+    call "domain_setmaxmem" (fun () -> Xenctrl.domain_setmaxmem xc 1 1048576L);
+    call "domain_set_memmap_limit" (fun () ->
+      Xenctrl.domain_set_memmap_limit xc 1 1048576L);
+    call "domain_memory_increase_reservation" (fun () ->
+      Xenctrl.domain_memory_increase_reservation xc 1 4L);
+    call "domain_set_machine_address_size" (fun () ->
+      Xenctrl.domain_set_machine_address_size xc 1 64);
+    call "domain_get_machine_address_size" (fun () ->
+      Xenctrl.domain_get_machine_address_size xc 1);
+    call "domain_sethandle" (fun () ->
+      Xenctrl.domain_sethandle xc 1 "0123abcd-4567-89ef-0a1b-456789abcdef");
+    call "shadow_allocation_set" (fun () ->
+      Xenctrl.shadow_allocation_set xc 1 32);
+    call "shadow_allocation_get" (fun () ->
+      Xenctrl.shadow_allocation_get xc 1);
+    call "domain_ioport_permission" (fun () ->
+      Xenctrl.domain_ioport_permission xc 1 0x3f8 8 true);
+    call "domain_iomem_permission" (fun () ->
+      Xenctrl.domain_iomem_permission xc 1 0xfee00n 1n true);
+    call "domain_irq_permission" (fun () ->
+      Xenctrl.domain_irq_permission xc 1 4 true);
+    call "hvm_check_pvdriver" (fun () -> Xenctrl.hvm_check_pvdriver xc 1);
+    call "vcpu_context_get" (fun () -> Xenctrl.vcpu_context_get xc 1 0);
+    call "watchdog" (fun () -> Xenctrl.watchdog xc 0 30l);
+    call "sched_credit_domain_get" (fun () ->
+      Xenctrl.sched_credit_domain_get xc 1);
+    call "sched_credit_domain_set" (fun () ->
+      Xenctrl.sched_credit_domain_set xc 1
+        { Xenctrl.weight = 256; cap = 0 });
+    call "evtchn_alloc_unbound" (fun () -> Xenctrl.evtchn_alloc_unbound xc 1 0);
+    call "evtchn_reset" (fun () -> Xenctrl.evtchn_reset xc 1);
+
+    call "map_foreign_range + unmap" (fun () ->
+      Xenmmap.unmap (Xenctrl.map_foreign_range xc 1 4096 1n));
+    call "map_foreign_bulk (16 frames) + unmap" (fun () ->
+      Xenmmap.unmap (Xenctrl.map_foreign_bulk xc 1 Xenmmap.RDWR frames
+                       frame_errors));
+    call "map_foreign_cached" (fun () ->
+      Xenctrl.map_foreign_cached map_cache xc 1 1n);
+
+    call "domain_pause + domain_unpause" (fun () ->
+      Array.iter (Xenctrl.domain_pause xc) domids;
+      Array.iter (Xenctrl.domain_unpause xc) domids);
+    call "domain_pause_many + unpause_many" (fun () ->
+      ignore (Xenctrl.domain_pause_many xc domids);
+      Xenctrl.domain_unpause_many xc domids);
+    scaling "domain_pause_many (all domains)" (fun () ->
+      let all = all_domids () in
+      ignore (Xenctrl.domain_pause_many xc all);
+      Xenctrl.domain_unpause_many xc all);
+    call "domain_shutdown + domain_resume_fast" (fun () ->
+      Xenctrl.domain_shutdown xc 1 Xenctrl.Suspend;
+      Xenctrl.domain_resume_fast xc 1);
+    call "domain_shutdown_many" (fun () ->
+      Xenctrl.domain_shutdown_many xc domids Xenctrl.Suspend);
+
+    call "domain_get_vcpuinfo" (fun () -> Xenctrl.domain_get_vcpuinfo xc 0 0);
+    call "domain_get_vcpuinfo_result" (fun () ->
+      Xenctrl.domain_get_vcpuinfo_result xc 0 0);
+    call "domain_get_all_vcpuinfo" (fun () ->
+      Xenctrl.domain_get_all_vcpuinfo xc 0);
+    scaling "all_domains_get_vcpuinfo" (fun () ->
+      Xenctrl.all_domains_get_vcpuinfo xc);
+    call "domain_get_runstate_info" (fun () ->
+      Xenctrl.domain_get_runstate_info xc 0);
+    scaling "runstate_sample" (fun () ->
+      Xenctrl.runstate_sample xc runstate_sampler true runstates);
+    call "vcpu_affinity_get" (fun () -> Xenctrl.vcpu_affinity_get xc 1 0);
+    call "vcpu_affinity_set" (fun () ->
+      Xenctrl.vcpu_affinity_set xc 1 0 affinity);
+    call "vcpu_affinity_get_cpumap" (fun () ->
+      Xenctrl.vcpu_affinity_get_cpumap xc 1 0);
+    call "vcpu_affinity_set_cpumap" (fun () ->
+      Xenctrl.vcpu_affinity_set_cpumap xc 1 0 cpumap);
+    call "domain_set_affinity_all_vcpus" (fun () ->
+      Xenctrl.domain_set_affinity_all_vcpus xc 1 (Array.make 4 cpumap));
+
+    call "cputopoinfo" (fun () -> Xenctrl.cputopoinfo xc);
+    call "numainfo" (fun () -> Xenctrl.numainfo xc);
+    call "numainfo + cputopoinfo + numa_place" (fun () ->
+      Xenctrl.numa_place (Xenctrl.numainfo xc) (Xenctrl.cputopoinfo xc)
+        ~vcpus:4 ~memory:(Int64.shift_left 4L 30));
+    call "get_cpu_featureset" (fun () ->
+      Xenctrl.get_cpu_featureset xc Xenctrl.Featureset_host);
+    call "get_cpu_featureset_packed" (fun () ->
+      Xenctrl.get_cpu_featureset_packed xc Xenctrl.Featureset_host);
+    call "oldstyle_featuremask" (fun () -> Xenctrl.oldstyle_featuremask xc);
+    call "upgrade_oldstyle_featuremask" (fun () ->
+      Xenctrl.upgrade_oldstyle_featuremask xc oldmask true);
+
+    (* The fake's console only fills through send_debug_keys: each read
+       returns one line *)
+    call "send_debug_keys" (fun () ->
+      Xenctrl.send_debug_keys xc console_line);
+    call "readconsolering" (fun () -> Xenctrl.readconsolering xc);
+    call "send_debug_keys + console_reader_read" (fun () ->
+      Xenctrl.send_debug_keys xc console_line;
+      Xenctrl.console_reader_read xc console);
+    call "send_debug_keys + console_reader_read_into" (fun () ->
+      Xenctrl.send_debug_keys xc console_line;
+      Xenctrl.console_reader_read_into xc console console_buf 0
+        (Bytes.length console_buf));
+    call "pages_to_kib" (fun () -> Xenctrl.pages_to_kib 256L);
+    call "xen_mb" Xenctrl.xen_mb;
+  ]
+
+(* Calls which need no handle *)
+let pure_calls () =
+  let call name f = name, (fun () -> ignore (f ())) in
+  match Xenctrl.with_intf (fun xc ->
+      Xenctrl.get_cpu_featureset_packed xc Xenctrl.Featureset_host) with
+  | exception e ->
+    Printf.printf "%-36s %s\n%!" "featureset ops" (Printexc.to_string e);
+    []
+  | fs ->
+    let hosts = Array.make 64 fs in
+    [
+      call "featureset_inter" (fun () -> Xenctrl.featureset_inter fs fs);
+      call "featureset_union" (fun () -> Xenctrl.featureset_union fs fs);
+      call "featureset_diff" (fun () -> Xenctrl.featureset_diff fs fs);
+      call "featureset_subset" (fun () -> Xenctrl.featureset_subset fs fs);
+      call "featureset_popcount" (fun () -> Xenctrl.featureset_popcount fs);
+      call "featureset_level (64 hosts)" (fun () ->
+        Xenctrl.featureset_level hosts);
+      call "Stats.snapshot" Xenctrl.Stats.snapshot;
+      call "Stats.to_prometheus" (fun () ->
+        Xenctrl.Stats.to_prometheus (Xenctrl.Stats.snapshot ()));
+    ]
+
+let () =
+  Xenctrl.with_intf (fun xc ->
+    let calls = calls xc in
+    match mode with
+    | "all" ->
+      bench_pool_contention ();
+      List.iter (fun (name, _, f) -> bench name f) calls;
+      Xenctrl.Stats.set_enabled true;
+      bench "domain_getinfo, stats enabled" (fun () ->
+        Xenctrl.domain_getinfo xc 0);
+      List.iter (fun (name, f) -> bench name f) (pure_calls ());
+      Xenctrl.Stats.set_enabled false
+    | "scaling" ->
+      Printf.printf "%d domains\n%!"
+        (List.length (Xenctrl.domain_getinfolist xc 0));
+      List.iter (fun (name, scales, f) -> if scales then bench name f) calls
+    | "stall" ->
+      List.iter (fun (name, _, f) -> stall name f) calls
+    | _ ->
+      prerr_endline ("unknown mode " ^ mode);
+      exit 2)
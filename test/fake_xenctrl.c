@@ -0,0 +1,961 @@
+/*
+ * An in-process stand-in for the parts of libxenctrl used by the xenctrl
+ * bindings, so that the stubs can be exercised and benchmarked without a
+ * Xen host. Build it as a shared object and LD_PRELOAD it: its symbols
+ * take the place of libxenctrl's.
+ *
+ *   cc -shared -fPIC -O2 -Ilib -o fake_xenctrl.so test/fake_xenctrl.c
+ *
+ * The model is sized from the environment:
+ *   XC_FAKE_DOMAINS     number of domains, domid 0 included (default 64)
+ *   XC_FAKE_VCPUS       vcpus per domain (default 4)
+ *   XC_FAKE_CPUS        physical CPUs (default 32)
+ *   XC_FAKE_NODES       NUMA nodes (default 2)
+ *   XC_FAKE_LATENCY_NS  time each hypercall spins for (default 0)
+ *   XC_FAKE_VIRQ_BUSY   if set, VIRQ_DOM_EXC is already bound elsewhere,
+ *                       as it is by xenstored on a real host
+ *   XC_FAKE_FAIL        name of a function, such as xc_domain_setmaxmem,
+ *                       which fails with EIO while the variable is set.
+ *                       It is read on every call, so a test can change it
+ *                       between calls
+ *
+ * The console ring holds FAKE_CONSOLE_SIZE characters, and only
+ * xc_send_debug_keys writes to it: it appends the keys themselves, in
+ * place of the output of their handlers.
+ *
+ * Only the functions below are faked. A handle from the fake
+ * xc_interface_open must not be passed to any other libxc function.
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; version 2.1 only. with the special
+ * exception on linking described in file LICENSE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#define XC_WANT_COMPAT_MAP_FOREIGN_API
+#define XC_WANT_COMPAT_EVTCHN_API
+#include <xenctrl.h>
+#include "config.h"
+
+#define PAGES_PER_DOMAIN (256 * 1024)
+
+/* Slots left after the initial domains for xc_domain_create */
+#define FAKE_SPARE_DOMAINS 256
+
+#define FAKE_CONSOLE_SIZE 16384
+
+struct fake_domain {
+	uint32_t domid;
+	int exists;
+	int paused;
+	int shutdown;
+	int shutdown_reason;
+	unsigned long shadow_mb;
+	/* Hard affinity of each vcpu, allocated on the first change:
+	 * until then every vcpu may run anywhere */
+	uint8_t *affinity;
+	uint64_t created;
+};
+
+struct xc_interface_core {
+	xc_error last_error;
+	int busy;
+};
+
+/* An event channel handle. As with /dev/xen/evtchn, each pending port
+ * is a 4-byte read from the fd, and a port does not fire again until it
+ * is unmasked. */
+struct fake_evtchn {
+	int fds[2];
+	int masked;
+};
+
+/* The only virq modelled, and the port it is bound to */
+#define FAKE_VIRQ_PORT 7
+
+static struct {
+	pthread_once_t once;
+	pthread_mutex_t lock;
+	int nr_domains;
+	int max_domains;
+	int nr_vcpus;
+	int nr_cpus;
+	int nr_nodes;
+	uint64_t latency_ns;
+	uint64_t boot;
+	struct fake_domain *domains;
+	int virq_busy;
+	struct fake_evtchn *virq_dom_exc;
+	/* As in Xen, the producer counts every character ever written and
+	 * wraps at 2^32 */
+	char console[FAKE_CONSOLE_SIZE];
+	uint32_t console_prod;
+} fake = {
+	.once = PTHREAD_ONCE_INIT,
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int env_int(const char *name, int def)
+{
+	const char *s = getenv(name);
+
+	return s ? atoi(s) : def;
+}
+
+static void fake_init(void)
+{
+	int i;
+
+	fake.nr_domains = env_int("XC_FAKE_DOMAINS", 64);
+	fake.nr_vcpus = env_int("XC_FAKE_VCPUS", 4);
+	fake.nr_cpus = env_int("XC_FAKE_CPUS", 32);
+	fake.nr_nodes = env_int("XC_FAKE_NODES", 2);
+	fake.latency_ns = env_int("XC_FAKE_LATENCY_NS", 0);
+	fake.boot = now_ns();
+	fake.virq_busy = getenv("XC_FAKE_VIRQ_BUSY") != NULL;
+
+	if (fake.nr_domains < 1)
+		fake.nr_domains = 1;
+	if (fake.nr_vcpus < 1)
+		fake.nr_vcpus = 1;
+	if (fake.nr_cpus < 1)
+		fake.nr_cpus = 1;
+	if (fake.nr_nodes < 1 || fake.nr_nodes > fake.nr_cpus)
+		fake.nr_nodes = 1;
+
+	fake.max_domains = fake.nr_domains + FAKE_SPARE_DOMAINS;
+	fake.domains = calloc(fake.max_domains, sizeof(*fake.domains));
+	if (!fake.domains)
+		abort();
+	for (i = 0; i < fake.nr_domains; i++) {
+		fake.domains[i].domid = i;
+		fake.domains[i].exists = 1;
+		fake.domains[i].created = fake.boot;
+	}
+}
+
+/* Every faked hypercall starts here: it models the time spent in the
+ * hypervisor by spinning, as a real hypercall keeps the CPU busy */
+static void hypercall(void)
+{
+	uint64_t end;
+
+	pthread_once(&fake.once, fake_init);
+	if (fake.latency_ns == 0)
+		return;
+	end = now_ns() + fake.latency_ns;
+	while (now_ns() < end)
+		;
+}
+
+static struct fake_domain *find_domain(uint32_t domid)
+{
+	if (domid >= (uint32_t) fake.nr_domains || !fake.domains[domid].exists)
+		return NULL;
+	return &fake.domains[domid];
+}
+
+static int fail(int err)
+{
+	errno = err;
+	return -1;
+}
+
+/* Whether XC_FAKE_FAIL names the calling function */
+static int injected(const char *fn)
+{
+	const char *s = getenv("XC_FAKE_FAIL");
+
+	return s && strcmp(s, fn) == 0;
+}
+
+/* Called with fake.lock held whenever a domain shuts down or dies */
+static void raise_dom_exc(void)
+{
+	struct fake_evtchn *e = fake.virq_dom_exc;
+	uint32_t port = FAKE_VIRQ_PORT;
+
+	if (e && !e->masked) {
+		e->masked = 1;
+		if (write(e->fds[1], &port, sizeof(port)) != sizeof(port))
+			abort();
+	}
+}
+
+xc_interface *xc_interface_open(xentoollog_logger *logger,
+                                xentoollog_logger *dombuild_logger,
+                                unsigned open_flags)
+{
+	pthread_once(&fake.once, fake_init);
+	return calloc(1, sizeof(struct xc_interface_core));
+}
+
+int xc_interface_close(xc_interface *xch)
+{
+	free(xch);
+	return 0;
+}
+
+const xc_error *xc_get_last_error(xc_interface *xch)
+{
+	return &xch->last_error;
+}
+
+void xc_clear_last_error(xc_interface *xch)
+{
+	xch->last_error.code = XC_ERROR_NONE;
+	xch->last_error.message[0] = '\0';
+}
+
+const char *xc_error_code_to_desc(int code)
+{
+	return code == XC_ERROR_NONE ? "No error details" : "Fake error";
+}
+
+int xc_domain_getinfolist(xc_interface *xch, uint32_t first_domain,
+                          unsigned int max_domains, xc_domaininfo_t *info)
+{
+	uint64_t now;
+	uint32_t d;
+	int n = 0;
+
+	hypercall();
+	now = now_ns();
+	pthread_mutex_lock(&fake.lock);
+	for (d = first_domain; d < (uint32_t) fake.nr_domains
+	                       && n < (int) max_domains; d++) {
+		struct fake_domain *dom = &fake.domains[d];
+		xc_domaininfo_t *i = &info[n];
+
+		if (!dom->exists)
+			continue;
+		memset(i, 0, sizeof(*i));
+		i->domain = dom->domid;
+		i->flags = dom->paused ? XEN_DOMINF_paused : XEN_DOMINF_running;
+		/* Odd domids are HVM guests */
+		if (d % 2)
+			i->flags |= XEN_DOMINF_hvm_guest;
+		if (dom->shutdown)
+			i->flags |= XEN_DOMINF_shutdown |
+				(dom->shutdown_reason << XEN_DOMINF_shutdownshift);
+		i->tot_pages = PAGES_PER_DOMAIN;
+		i->max_pages = PAGES_PER_DOMAIN;
+		i->shared_info_frame = 0x1000 + d;
+		/* Running domains accumulate cpu time, so that pollers see
+		 * a change on every call */
+		i->cpu_time = dom->paused ? 0 : now - dom->created;
+		i->nr_online_vcpus = fake.nr_vcpus;
+		i->max_vcpu_id = fake.nr_vcpus - 1;
+		memcpy(i->handle, &dom->domid, sizeof(dom->domid));
+		n++;
+	}
+	pthread_mutex_unlock(&fake.lock);
+	return n;
+}
+
+int xc_vcpu_getinfo(xc_interface *xch, uint32_t domid, uint32_t vcpu,
+                    xc_vcpuinfo_t *info)
+{
+	hypercall();
+	if (!find_domain(domid))
+		return fail(ESRCH);
+	if (vcpu >= (uint32_t) fake.nr_vcpus)
+		return fail(EINVAL);
+	memset(info, 0, sizeof(*info));
+	info->vcpu = vcpu;
+	info->online = 1;
+	info->running = !fake.domains[domid].paused;
+	info->blocked = fake.domains[domid].paused;
+	info->cpu_time = now_ns() - fake.boot;
+	info->cpu = (domid * fake.nr_vcpus + vcpu) % fake.nr_cpus;
+	return 0;
+}
+
+#if defined(XENCTRL_HAS_GET_RUNSTATE_INFO)
+int xc_get_runstate_info(xc_interface *xch, uint32_t domid,
+                         xc_runstate_info_t *info)
+{
+	uint64_t t;
+
+	hypercall();
+	if (!find_domain(domid))
+		return fail(ESRCH);
+	t = now_ns() - fake.boot;
+	memset(info, 0, sizeof(*info));
+	info->state = 0;
+	info->state_entry_time = t;
+	info->time[0] = t / 2;
+	info->time[1] = t / 4;
+	info->time[2] = t / 4;
+	return 0;
+}
+#endif
+
+int xc_physinfo(xc_interface *xch, xc_physinfo_t *info)
+{
+	hypercall();
+	memset(info, 0, sizeof(*info));
+	info->threads_per_core = 2;
+	info->cores_per_socket = fake.nr_cpus / (2 * fake.nr_nodes) ?
+		fake.nr_cpus / (2 * fake.nr_nodes) : 1;
+	info->nr_cpus = fake.nr_cpus;
+	info->max_cpu_id = fake.nr_cpus - 1;
+	info->nr_nodes = fake.nr_nodes;
+	info->max_node_id = fake.nr_nodes - 1;
+	info->cpu_khz = 2400000;
+	info->total_pages = 16ULL * 1024 * 1024;
+	info->free_pages = info->total_pages -
+		(uint64_t) fake.nr_domains * PAGES_PER_DOMAIN;
+	info->capabilities = XEN_SYSCTL_PHYSCAP_hvm;
+	return 0;
+}
+
+int xc_getcpuinfo(xc_interface *xch, int max_cpus, xc_cpuinfo_t *info,
+                  int *nr_cpus)
+{
+	uint64_t t;
+	int i;
+
+	hypercall();
+	t = now_ns() - fake.boot;
+	*nr_cpus = max_cpus < fake.nr_cpus ? max_cpus : fake.nr_cpus;
+	/* pCPU i is idle (i % 4) quarters of the time */
+	for (i = 0; i < *nr_cpus; i++)
+		info[i].idletime = t / 4 * (i % 4);
+	return 0;
+}
+
+int xc_get_max_cpus(xc_interface *xch)
+{
+	pthread_once(&fake.once, fake_init);
+	return fake.nr_cpus;
+}
+
+int xc_get_cpumap_size(xc_interface *xch)
+{
+	return (xc_get_max_cpus(xch) + 7) / 8;
+}
+
+xc_cpumap_t xc_cpumap_alloc(xc_interface *xch)
+{
+	return calloc(1, xc_get_cpumap_size(xch));
+}
+
+/* As libxc does, the effective affinity, limited to the CPUs which
+ * exist, is written back into the hard map */
+int xc_vcpu_setaffinity(xc_interface *xch, uint32_t domid, int vcpu,
+                        xc_cpumap_t cpumap_hard_inout,
+                        xc_cpumap_t cpumap_soft_inout, uint32_t flags)
+{
+	int size = xc_get_cpumap_size(xch);
+	struct fake_domain *dom;
+	int i, ret = 0;
+
+	hypercall();
+	if (injected(__func__))
+		return fail(EIO);
+	for (i = fake.nr_cpus; i < size * 8; i++)
+		cpumap_hard_inout[i / 8] &= ~(1 << (i % 8));
+	pthread_mutex_lock(&fake.lock);
+	dom = find_domain(domid);
+	if (!dom)
+		ret = fail(ESRCH);
+	else if (vcpu < 0 || vcpu >= fake.nr_vcpus)
+		ret = fail(EINVAL);
+	else if (!dom->affinity) {
+		dom->affinity = malloc((size_t) fake.nr_vcpus * size);
+		if (!dom->affinity)
+			ret = fail(ENOMEM);
+		else
+			memset(dom->affinity, 0xff, (size_t) fake.nr_vcpus * size);
+	}
+	if (ret == 0)
+		memcpy(dom->affinity + (size_t) vcpu * size, cpumap_hard_inout,
+		       size);
+	pthread_mutex_unlock(&fake.lock);
+	return ret;
+}
+
+int xc_vcpu_getaffinity(xc_interface *xch, uint32_t domid, int vcpu,
+                        xc_cpumap_t cpumap_hard, xc_cpumap_t cpumap_soft,
+                        uint32_t flags)
+{
+	int size = xc_get_cpumap_size(xch);
+	struct fake_domain *dom;
+
+	hypercall();
+	pthread_mutex_lock(&fake.lock);
+	dom = find_domain(domid);
+	if (dom && vcpu >= 0 && vcpu < fake.nr_vcpus && cpumap_hard) {
+		if (dom->affinity)
+			memcpy(cpumap_hard, dom->affinity + (size_t) vcpu * size,
+			       size);
+		else
+			memset(cpumap_hard, 0xff, size);
+	}
+	pthread_mutex_unlock(&fake.lock);
+	if (!dom)
+		return fail(ESRCH);
+	if (vcpu < 0 || vcpu >= fake.nr_vcpus)
+		return fail(EINVAL);
+	if (cpumap_soft)
+		memset(cpumap_soft, 0xff, size);
+	return 0;
+}
+
+static int set_paused(uint32_t domid, int paused)
+{
+	struct fake_domain *dom;
+
+	hypercall();
+	pthread_mutex_lock(&fake.lock);
+	dom = find_domain(domid);
+	if (dom)
+		dom->paused = paused;
+	pthread_mutex_unlock(&fake.lock);
+	return dom ? 0 : fail(ESRCH);
+}
+
+int xc_domain_pause(xc_interface *xch, uint32_t domid)
+{
+	return set_paused(domid, 1);
+}
+
+int xc_domain_unpause(xc_interface *xch, uint32_t domid)
+{
+	return set_paused(domid, 0);
+}
+
+int xc_domain_shutdown(xc_interface *xch, uint32_t domid, int reason)
+{
+	struct fake_domain *dom;
+
+	hypercall();
+	pthread_mutex_lock(&fake.lock);
+	dom = find_domain(domid);
+	if (dom) {
+		dom->shutdown = 1;
+		dom->shutdown_reason = reason;
+		raise_dom_exc();
+	}
+	pthread_mutex_unlock(&fake.lock);
+	return dom ? 0 : fail(ESRCH);
+}
+
+/* New domains take the next unused domid: destroyed domids are not
+ * reused, so that a test can tell a new domain from an old one */
+int xc_domain_create(xc_interface *xch, uint32_t ssidref,
+                     xen_domain_handle_t handle, uint32_t flags,
+                     uint32_t *pdomid
+#ifdef DOMAIN_CREATE_HAS_CONFIG
+                     , xc_domain_configuration_t *config
+#endif
+                     )
+{
+	struct fake_domain *dom = NULL;
+
+	hypercall();
+	if (injected(__func__))
+		return fail(EIO);
+	pthread_mutex_lock(&fake.lock);
+	if (fake.nr_domains < fake.max_domains) {
+		dom = &fake.domains[fake.nr_domains];
+		memset(dom, 0, sizeof(*dom));
+		dom->domid = fake.nr_domains++;
+		dom->exists = 1;
+		dom->paused = 1;
+		dom->created = now_ns();
+		*pdomid = dom->domid;
+	}
+	pthread_mutex_unlock(&fake.lock);
+	return dom ? 0 : fail(ENOSPC);
+}
+
+int xc_domain_destroy(xc_interface *xch, uint32_t domid)
+{
+	struct fake_domain *dom;
+
+	/* A handle, and its last error, belongs to one thread at a time:
+	 * catch callers which share one, as parallel destroys might */
+	if (__atomic_exchange_n(&xch->busy, 1, __ATOMIC_ACQUIRE))
+		return fail(EBUSY);
+	hypercall();
+	pthread_mutex_lock(&fake.lock);
+	dom = find_domain(domid);
+	if (dom && domid != 0) {
+		dom->exists = 0;
+		raise_dom_exc();
+	}
+	pthread_mutex_unlock(&fake.lock);
+	__atomic_store_n(&xch->busy, 0, __ATOMIC_RELEASE);
+	if (!dom)
+		return fail(ESRCH);
+	return domid != 0 ? 0 : fail(EPERM);
+}
+
+#ifdef HAVE_XEN_4_6
+int xc_cputopoinfo(xc_interface *xch, unsigned *max_cpus,
+                   xc_cputopo_t *cputopo)
+{
+	unsigned int i, per_node;
+
+	hypercall();
+	if (!cputopo) {
+		*max_cpus = fake.nr_cpus;
+		return 0;
+	}
+	if (*max_cpus > (unsigned) fake.nr_cpus)
+		*max_cpus = fake.nr_cpus;
+	per_node = fake.nr_cpus / fake.nr_nodes;
+	for (i = 0; i < *max_cpus; i++) {
+		cputopo[i].core = i / 2;
+		cputopo[i].socket = i / per_node;
+		cputopo[i].node = i / per_node < (unsigned) fake.nr_nodes ?
+			i / per_node : XEN_INVALID_NODE_ID;
+	}
+	return 0;
+}
+
+int xc_numainfo(xc_interface *xch, unsigned *max_nodes,
+                xc_meminfo_t *meminfo, uint32_t *distance)
+{
+	unsigned int i, j, nr;
+
+	hypercall();
+	if (!meminfo && !distance) {
+		*max_nodes = fake.nr_nodes;
+		return 0;
+	}
+	nr = *max_nodes < (unsigned) fake.nr_nodes ? *max_nodes : fake.nr_nodes;
+	for (i = 0; i < nr; i++) {
+		if (meminfo) {
+			meminfo[i].memsize = 64ULL << 30;
+			meminfo[i].memfree = (32ULL << 30) + ((uint64_t) i << 30);
+		}
+		if (distance)
+			for (j = 0; j < nr; j++)
+				distance[i * nr + j] = i == j ? 10 : 21;
+	}
+	*max_nodes = nr;
+	return 0;
+}
+#endif
+
+/* Foreign pages are anonymous memory whose first word is the frame number,
+ * so that tests can tell which frame they are looking at */
+void *xc_map_foreign_range(xc_interface *xch, uint32_t dom, int size,
+                           int prot, unsigned long mfn)
+{
+	void *addr;
+
+	hypercall();
+	if (!find_domain(dom)) {
+		errno = ESRCH;
+		return NULL;
+	}
+	addr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+	            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (addr == MAP_FAILED)
+		return NULL;
+	memcpy(addr, &mfn, sizeof(mfn));
+	return addr;
+}
+
+/* Incremental reads resume from *pindex, and skip to the oldest
+ * character still in the ring if the ring has overwritten it */
+int xc_readconsolering(xc_interface *xch, char *buffer,
+                       unsigned int *pnr_chars, int clear, int incremental,
+                       uint32_t *pindex)
+{
+	uint32_t c = incremental ? *pindex : 0;
+	unsigned int n = 0;
+
+	hypercall();
+	pthread_mutex_lock(&fake.lock);
+	if (fake.console_prod - c > FAKE_CONSOLE_SIZE)
+		c = fake.console_prod - FAKE_CONSOLE_SIZE;
+	while (c != fake.console_prod && n < *pnr_chars)
+		buffer[n++] = fake.console[c++ % FAKE_CONSOLE_SIZE];
+	pthread_mutex_unlock(&fake.lock);
+	*pnr_chars = n;
+	if (incremental)
+		*pindex = c;
+	return 0;
+}
+
+int xc_send_debug_keys(xc_interface *xch, char *keys)
+{
+	size_t i, n = strlen(keys);
+
+	hypercall();
+	pthread_mutex_lock(&fake.lock);
+	for (i = 0; i < n; i++)
+		fake.console[fake.console_prod++ % FAKE_CONSOLE_SIZE] = keys[i];
+	pthread_mutex_unlock(&fake.lock);
+	return 0;
+}
+
+int xc_sched_id(xc_interface *xch, int *sched_id)
+{
+	hypercall();
+	*sched_id = XEN_SCHEDULER_CREDIT;
+	return 0;
+}
+
+/* Calls which only look the domain up: they succeed for any domain
+ * which exists and change nothing */
+static int domain_op(uint32_t domid)
+{
+	struct fake_domain *dom;
+
+	hypercall();
+	pthread_mutex_lock(&fake.lock);
+	dom = find_domain(domid);
+	pthread_mutex_unlock(&fake.lock);
+	return dom ? 0 : fail(ESRCH);
+}
+
+/* The same, for the steps of building a domain, which XC_FAKE_FAIL can
+ * make fail */
+static int domain_step(const char *fn, uint32_t domid)
+{
+	if (injected(fn)) {
+		hypercall();
+		return fail(EIO);
+	}
+	return domain_op(domid);
+}
+
+int xc_domain_max_vcpus(xc_interface *xch, uint32_t domid, unsigned int max)
+{
+	return domain_step(__func__, domid);
+}
+
+int xc_domain_setmaxmem(xc_interface *xch, uint32_t domid,
+                        uint64_t max_memkb)
+{
+	return domain_step(__func__, domid);
+}
+
+int xc_shadow_control(xc_interface *xch, uint32_t domid, unsigned int sop,
+                      xc_hypercall_buffer_t *dirty_bitmap,
+                      unsigned long pages, unsigned long *mb,
+                      uint32_t mode, xc_shadow_op_stats_t *stats)
+{
+	struct fake_domain *dom;
+
+	if (domain_step(__func__, domid))
+		return -1;
+	if (sop != XEN_DOMCTL_SHADOW_OP_GET_ALLOCATION &&
+	    sop != XEN_DOMCTL_SHADOW_OP_SET_ALLOCATION)
+		return fail(EINVAL);
+	pthread_mutex_lock(&fake.lock);
+	dom = find_domain(domid);
+	if (dom && sop == XEN_DOMCTL_SHADOW_OP_SET_ALLOCATION)
+		dom->shadow_mb = *mb;
+	else if (dom)
+		*mb = dom->shadow_mb;
+	pthread_mutex_unlock(&fake.lock);
+	return dom ? 0 : fail(ESRCH);
+}
+
+int xc_domain_set_memmap_limit(xc_interface *xch, uint32_t domid,
+                               unsigned long map_limitkb)
+{
+	return domain_op(domid);
+}
+
+int xc_domain_set_machine_address_size(xc_interface *xch, uint32_t domid,
+                                       unsigned int width)
+{
+	return domain_step(__func__, domid);
+}
+
+int xc_domain_get_machine_address_size(xc_interface *xch, uint32_t domid)
+{
+	return domain_op(domid) ? -1 : 64;
+}
+
+int xc_domain_increase_reservation_exact(xc_interface *xch, uint32_t domid,
+                                         unsigned long nr_extents,
+                                         unsigned int extent_order,
+                                         unsigned int mem_flags,
+                                         xen_pfn_t *extent_start)
+{
+	return domain_op(domid);
+}
+
+int xc_domain_sethandle(xc_interface *xch, uint32_t domid,
+                        xen_domain_handle_t handle)
+{
+	return domain_op(domid);
+}
+
+int xc_domain_resume(xc_interface *xch, uint32_t domid, int fast)
+{
+	struct fake_domain *dom;
+
+	hypercall();
+	pthread_mutex_lock(&fake.lock);
+	dom = find_domain(domid);
+	if (dom)
+		dom->shutdown = 0;
+	pthread_mutex_unlock(&fake.lock);
+	return dom ? 0 : fail(ESRCH);
+}
+
+int xc_domain_ioport_permission(xc_interface *xch, uint32_t domid,
+                                uint32_t first_port, uint32_t nr_ports,
+                                uint32_t allow_access)
+{
+	return domain_op(domid);
+}
+
+int xc_domain_iomem_permission(xc_interface *xch, uint32_t domid,
+                               unsigned long first_mfn,
+                               unsigned long nr_mfns, uint8_t allow_access)
+{
+	return domain_op(domid);
+}
+
+int xc_domain_irq_permission(xc_interface *xch, uint32_t domid,
+                             uint8_t pirq, uint8_t allow_access)
+{
+	return domain_op(domid);
+}
+
+int xc_watchdog(xc_interface *xch, uint32_t id, uint32_t timeout)
+{
+	hypercall();
+	return id;
+}
+
+int xc_evtchn_alloc_unbound(xc_interface *xch, uint32_t dom,
+                            uint32_t remote_dom)
+{
+	return domain_op(dom) ? -1 : FAKE_VIRQ_PORT + 1;
+}
+
+int xc_evtchn_reset(xc_interface *xch, uint32_t dom)
+{
+	return domain_op(dom);
+}
+
+int xc_sched_credit_domain_get(xc_interface *xch, uint32_t domid,
+                               struct xen_domctl_sched_credit *sdom)
+{
+	if (domain_op(domid))
+		return -1;
+	sdom->weight = 256;
+	sdom->cap = 0;
+	return 0;
+}
+
+int xc_sched_credit_domain_set(xc_interface *xch, uint32_t domid,
+                               struct xen_domctl_sched_credit *sdom)
+{
+	return domain_step(__func__, domid);
+}
+
+int xc_vcpu_getcontext(xc_interface *xch, uint32_t domid, uint32_t vcpu,
+                       vcpu_guest_context_any_t *ctxt)
+{
+	if (domain_op(domid))
+		return -1;
+	if (vcpu >= (uint32_t) fake.nr_vcpus)
+		return fail(EINVAL);
+	memset(ctxt, 0, sizeof(*ctxt));
+	return 0;
+}
+
+int xc_get_hvm_param(xc_interface *xch, domid_t domid, int param,
+                     unsigned long *value)
+{
+	if (domain_op(domid))
+		return -1;
+	/* HVM guests have PV drivers with a callback irq */
+	*value = domid % 2 ? 28 : 0;
+	return 0;
+}
+
+int xc_version(xc_interface *xch, int cmd, void *arg)
+{
+	hypercall();
+	switch (cmd) {
+	case XENVER_version:
+		return (4 << 16) | 6;
+	case XENVER_extraversion:
+		snprintf(arg, sizeof(xen_extraversion_t), ".0-fake");
+		return 0;
+	case XENVER_compile_info: {
+		xen_compile_info_t *ci = arg;
+
+		memset(ci, 0, sizeof(*ci));
+		snprintf(ci->compiler, sizeof(ci->compiler), "cc");
+		snprintf(ci->compile_by, sizeof(ci->compile_by), "fake");
+		snprintf(ci->compile_domain, sizeof(ci->compile_domain), "fake");
+		snprintf(ci->compile_date, sizeof(ci->compile_date), "today");
+		return 0;
+	}
+	case XENVER_changeset:
+		snprintf(arg, sizeof(xen_changeset_info_t), "fake");
+		return 0;
+	case XENVER_capabilities:
+		snprintf(arg, sizeof(xen_capabilities_info_t),
+		         "xen-3.0-x86_64 hvm-3.0-x86_64");
+		return 0;
+	default:
+		return fail(EINVAL);
+	}
+}
+
+/* Each page of a bulk mapping starts with its frame number, as with
+ * xc_map_foreign_range */
+/* As with privcmd, a frame the domain does not own fails on its own:
+ * its page is left empty and the rest of the batch is mapped */
+void *xc_map_foreign_bulk(xc_interface *xch, uint32_t dom, int prot,
+                          const xen_pfn_t *arr, int *err, unsigned int num)
+{
+	char *addr;
+	unsigned int i;
+
+	if (domain_op(dom))
+		return NULL;
+	addr = mmap(NULL, (size_t) num * XC_PAGE_SIZE, PROT_READ | PROT_WRITE,
+	            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (addr == MAP_FAILED)
+		return NULL;
+	for (i = 0; i < num; i++) {
+		if (arr[i] >= PAGES_PER_DOMAIN) {
+			err[i] = -EINVAL;
+			continue;
+		}
+		memcpy(addr + (size_t) i * XC_PAGE_SIZE, &arr[i], sizeof(arr[i]));
+		err[i] = 0;
+	}
+	return addr;
+}
+
+#ifdef XEN_SYSCTL_cpu_featureset_raw
+int xc_get_cpu_featureset(xc_interface *xch, uint32_t index,
+                          uint32_t *nr_features, uint32_t *featureset)
+{
+	static const uint32_t fs[] = {
+		0xbfebfbff, 0x77fefbff, 0x2c100800, 0x00000121,
+		0x001c0fbb, 0x00000000, 0x00000000, 0x00000000,
+		0x00000100, 0x00000000,
+	};
+	uint32_t i, nr = sizeof(fs) / sizeof(fs[0]);
+
+	hypercall();
+	if (!featureset) {
+		*nr_features = nr;
+		return 0;
+	}
+	if (*nr_features < nr) {
+		*nr_features = nr;
+		return fail(ENOBUFS);
+	}
+	for (i = 0; i < nr; i++)
+		featureset[i] = index == 0 ? fs[i] : fs[i] & 0xfffffffe;
+	*nr_features = nr;
+	return 0;
+}
+#endif
+
+xc_evtchn *xc_evtchn_open(xentoollog_logger *logger, unsigned open_flags)
+{
+	struct fake_evtchn *e;
+
+	pthread_once(&fake.once, fake_init);
+	e = calloc(1, sizeof(*e));
+	if (!e)
+		return NULL;
+	if (pipe(e->fds)) {
+		free(e);
+		return NULL;
+	}
+	return (xc_evtchn *) e;
+}
+
+int xc_evtchn_close(xc_evtchn *xce)
+{
+	struct fake_evtchn *e = (struct fake_evtchn *) xce;
+
+	pthread_mutex_lock(&fake.lock);
+	if (fake.virq_dom_exc == e)
+		fake.virq_dom_exc = NULL;
+	pthread_mutex_unlock(&fake.lock);
+	close(e->fds[0]);
+	close(e->fds[1]);
+	free(e);
+	return 0;
+}
+
+int xc_evtchn_fd(xc_evtchn *xce)
+{
+	return ((struct fake_evtchn *) xce)->fds[0];
+}
+
+evtchn_port_or_error_t xc_evtchn_bind_virq(xc_evtchn *xce, unsigned int virq)
+{
+	int busy;
+
+	hypercall();
+	if (virq != VIRQ_DOM_EXC)
+		return fail(EINVAL);
+	pthread_mutex_lock(&fake.lock);
+	/* A global virq can only be bound once per domain */
+	busy = fake.virq_busy || fake.virq_dom_exc;
+	if (!busy)
+		fake.virq_dom_exc = (struct fake_evtchn *) xce;
+	pthread_mutex_unlock(&fake.lock);
+	return busy ? fail(EEXIST) : FAKE_VIRQ_PORT;
+}
+
+int xc_evtchn_unbind(xc_evtchn *xce, evtchn_port_t port)
+{
+	pthread_mutex_lock(&fake.lock);
+	if (fake.virq_dom_exc == (struct fake_evtchn *) xce &&
+	    port == FAKE_VIRQ_PORT)
+		fake.virq_dom_exc = NULL;
+	pthread_mutex_unlock(&fake.lock);
+	return 0;
+}
+
+evtchn_port_or_error_t xc_evtchn_pending(xc_evtchn *xce)
+{
+	struct fake_evtchn *e = (struct fake_evtchn *) xce;
+	uint32_t port;
+
+	if (read(e->fds[0], &port, sizeof(port)) != sizeof(port))
+		return -1;
+	return port;
+}
+
+int xc_evtchn_unmask(xc_evtchn *xce, evtchn_port_t port)
+{
+	pthread_mutex_lock(&fake.lock);
+	((struct fake_evtchn *) xce)->masked = 0;
+	pthread_mutex_unlock(&fake.lock);
+	return 0;
+}
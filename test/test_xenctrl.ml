@@ -0,0 +1,788 @@
+(* Unit tests for Xenctrl. The pure parts run anywhere; tests of the
+   hypercall wrappers run only against test/fake_xenctrl.c, which
+   'make test' LD_PRELOADs, and are skipped otherwise. *)
+
+let failures = ref 0
+
+let check msg b = if not b then failwith msg
+
+let contains s sub =
+  let n = String.length sub in
+  let rec from i =
+    i + n <= String.length s && (String.sub s i n = sub || from (i + 1)) in
+  from 0
+
+let against_fake =
+  try contains (Sys.getenv "LD_PRELOAD") "fake_xenctrl"
+  with Not_found -> false
+
+let run (name, needs_fake, f) =
+  if needs_fake && not against_fake then
+    Printf.printf "%-40s skipped (needs fake_xenctrl.so)\n%!" name
+  else
+    match f () with
+    | () -> Printf.printf "%-40s ok\n%!" name
+    | exception e ->
+      incr failures;
+      Printf.printf "%-40s FAILED: %s\n%!" name (Printexc.to_string e)
+
+(* Domain watcher *)
+
+let readable fd =
+  match Unix.select [fd] [] [] 0. with
+  | [], _, _ -> false
+  | _ -> true
+
+let test_domain_watcher_virq () =
+  Xenctrl.with_intf (fun xc ->
+    let w = Xenctrl.domain_watcher_create () in
+    let fd = match Xenctrl.domain_watcher_fd w with
+      | Some fd -> fd
+      | None -> failwith "watcher is polling" in
+    let _, first = Xenctrl.domain_watcher_changes xc w in
+    check "first call reports every domain"
+      (List.length first = List.length (Xenctrl.domain_getinfolist xc 0));
+    check "no event pending" (not (readable fd));
+    let _, quiet = Xenctrl.domain_watcher_changes xc w in
+    check "no event, no changes" (quiet = []);
+
+    Xenctrl.domain_shutdown xc 1 Xenctrl.Poweroff;
+    check "shutdown raises the virq" (readable fd);
+    let _, changes = Xenctrl.domain_watcher_changes xc w in
+    check "shutdown is reported" (List.exists (function
+      | Xenctrl.Domain_changed i -> i.Xenctrl.domid = 1 && i.Xenctrl.shutdown
+      | _ -> false) changes);
+    check "virq acknowledged" (not (readable fd));
+
+    Xenctrl.domain_destroy xc 2;
+    check "destroy raises the virq" (readable fd);
+    let _, changes = Xenctrl.domain_watcher_changes xc w in
+    check "destroy is reported"
+      (List.mem (Xenctrl.Domain_destroyed 2) changes);
+    Xenctrl.domain_watcher_close w)
+
+let test_domain_watcher_fallback () =
+  Xenctrl.with_intf (fun xc ->
+    let holder = Xenctrl.domain_watcher_create () in
+    check "first watcher holds the virq"
+      (Xenctrl.domain_watcher_fd holder <> None);
+    let w = Xenctrl.domain_watcher_create () in
+    check "second watcher polls" (Xenctrl.domain_watcher_fd w = None);
+    ignore (Xenctrl.domain_watcher_changes xc w);
+    Xenctrl.domain_shutdown xc 3 Xenctrl.Reboot;
+    let _, changes = Xenctrl.domain_watcher_changes xc w in
+    check "polling watcher sees the shutdown" (List.exists (function
+      | Xenctrl.Domain_changed i -> i.Xenctrl.domid = 3
+      | _ -> false) changes);
+    Xenctrl.domain_watcher_close w;
+    Xenctrl.domain_watcher_close holder)
+
+(* Vcpu info *)
+
+let test_all_vcpuinfo_missing_domain () =
+  Xenctrl.with_intf (fun xc ->
+    match Xenctrl.domain_get_all_vcpuinfo xc 9999 with
+    | _ -> failwith "no error for a missing domain"
+    | exception Xenctrl.Error msg ->
+      check ("ESRCH expected, got " ^ msg)
+        (String.length msg >= 2 && String.sub msg 0 2 = "3:"))
+
+(* Domain building *)
+
+let uuid = "0123abcd-4567-89ef-0a1b-456789abcdef"
+
+let full_config xc = {
+  Xenctrl.cfg_ssidref = 0l;
+  cfg_flags = [];
+  cfg_max_vcpus = 2;
+  cfg_max_memkb = 1048576L;
+  cfg_shadow_mb = Some 32;
+  cfg_address_size = Some 32;
+  cfg_sched = Some { Xenctrl.weight = 512; cap = 0 };
+  cfg_affinity = [| Xenctrl.cpumap_create xc |];
+}
+
+let domids xc =
+  List.map (fun i -> i.Xenctrl.domid) (Xenctrl.domain_getinfolist xc 0)
+
+let with_failing fn f =
+  Unix.putenv "XC_FAKE_FAIL" fn;
+  Fun.protect f ~finally:(fun () -> Unix.putenv "XC_FAKE_FAIL" "")
+
+let test_domain_create_full_rollback () =
+  Xenctrl.with_intf (fun xc ->
+    let config = full_config xc in
+    List.iter (fun fn ->
+      let before = domids xc in
+      with_failing fn (fun () ->
+        match Xenctrl.domain_create_full xc config uuid with
+        | domid -> failwith (Printf.sprintf "%s: domain %d created" fn domid)
+        | exception Xenctrl.Error msg ->
+          check (fn ^ ": EIO expected, got " ^ msg)
+            (String.length msg >= 2 && String.sub msg 0 2 = "5:"));
+      check (fn ^ ": no domain left behind") (domids xc = before)) [
+      "xc_domain_create";
+      "xc_domain_max_vcpus";
+      "xc_domain_setmaxmem";
+      "xc_shadow_control";
+      "xc_domain_set_machine_address_size";
+      "xc_sched_credit_domain_set";
+      "xc_vcpu_setaffinity";
+    ];
+    let domid = Xenctrl.domain_create_full xc config uuid in
+    check "the new domain exists" (List.mem domid (domids xc));
+    check "shadow allocation applied"
+      (Xenctrl.shadow_allocation_get xc domid = 32);
+    Xenctrl.domain_destroy xc domid)
+
+let test_domain_destroy_many () =
+  Xenctrl.with_intf (fun xc ->
+    let fresh () = Xenctrl.domain_create xc 0l [] uuid in
+    let created = Array.init 12 (fun _ -> fresh ()) in
+    (* A missing domain and domid 0, which cannot be destroyed, in the
+       middle of the batch *)
+    let batch = Array.concat [
+      Array.sub created 0 5; [| 9999; 0 |]; Array.sub created 5 7 ] in
+    let results = Xenctrl.domain_destroy_many ~workers:4 xc batch in
+    check "one result per domain" (Array.length results = Array.length batch);
+    Array.iteri (fun i domid ->
+      let expected = if domid = 9999 then 3 else if domid = 0 then 1 else 0 in
+      check (Printf.sprintf "domain %d: errno %d, expected %d"
+               domid results.(i) expected)
+        (results.(i) = expected)) batch;
+    let left = domids xc in
+    check "created domains destroyed"
+      (Array.for_all (fun d -> not (List.mem d left)) created);
+    check "domain 0 left alone" (List.mem 0 left);
+    let again = Xenctrl.domain_destroy_many ~workers:4 xc created in
+    check "destroyed twice, every domain is missing"
+      (Array.for_all (( = ) 3) again))
+
+(* Console reader *)
+
+(* The fake's console ring, written to by send_debug_keys only *)
+let console_size = 16384
+
+let rec drain xc r =
+  if Xenctrl.console_reader_read xc r <> "" then drain xc r
+
+let test_console_reader () =
+  Xenctrl.with_intf (fun xc ->
+    let r = Xenctrl.console_reader_create 64 in
+    drain xc r;
+    Xenctrl.send_debug_keys xc "hello\n";
+    check "new characters" (Xenctrl.console_reader_read xc r = "hello\n");
+    check "nothing new" (Xenctrl.console_reader_read xc r = "");
+
+    let line = String.init 100 (fun i -> Char.chr (0x41 + i mod 26)) in
+    Xenctrl.send_debug_keys xc line;
+    let first = Xenctrl.console_reader_read xc r in
+    let rest = Xenctrl.console_reader_read xc r in
+    check "at most size characters per read" (String.length first = 64);
+    check "the rest on the next read" (first ^ rest = line);
+
+    Xenctrl.send_debug_keys xc "abcdef";
+    let buf = Bytes.make 8 '.' in
+    check "read_into stops at len"
+      (Xenctrl.console_reader_read_into xc r buf 2 4 = 4);
+    check "read_into writes at off" (Bytes.to_string buf = "..abcd..");
+    check "left over characters are kept"
+      (Xenctrl.console_reader_read xc r = "ef");
+    check "read_into checks its bounds"
+      (try ignore (Xenctrl.console_reader_read_into xc r buf 6 4); false
+       with Invalid_argument _ -> true);
+
+    (* Past a full ring, the characters overwritten are lost and the
+       reader resumes at the oldest one left *)
+    let big = Xenctrl.console_reader_create (2 * console_size) in
+    drain xc big;
+    let flood = String.init (console_size + 1000)
+        (fun i -> Char.chr (0x61 + i mod 26)) in
+    Xenctrl.send_debug_keys xc flood;
+    check "a wrapped ring returns its last characters"
+      (Xenctrl.console_reader_read xc big
+       = String.sub flood 1000 console_size);
+    check "readconsolering returns the whole ring"
+      (Xenctrl.readconsolering xc = String.sub flood 1000 console_size);
+
+    List.iter (fun size ->
+      check (Printf.sprintf "size %d rejected" size)
+        (try ignore (Xenctrl.console_reader_create size); false
+         with Invalid_argument _ -> true)) [0; -1; (1 lsl 30) + 1])
+
+(* Physical CPU load *)
+
+let close_to a b = abs_float (a -. b) < 0.05
+
+let test_pcpu_sampler () =
+  Xenctrl.with_intf (fun xc ->
+    let physinfo = Xenctrl.physinfo xc in
+    let nr = physinfo.Xenctrl.nr_cpus in
+    let s = Xenctrl.pcpu_sampler_create nr in
+    let busy = Xenctrl.pcpu_busy_create nr in
+    check "first sample is a baseline" (Xenctrl.pcpu_sample xc s busy = 0);
+    Unix.sleepf 0.05;
+    check "every cpu sampled" (Xenctrl.pcpu_sample xc s busy = nr);
+    (* The fake's pCPU i is idle (i mod 4) quarters of the time *)
+    for i = 0 to nr - 1 do
+      let expected = 1. -. float_of_int (i mod 4) /. 4. in
+      check (Printf.sprintf "cpu %d busy %f, expected %f" i busy.{i} expected)
+        (close_to busy.{i} expected)
+    done;
+    let small = Xenctrl.pcpu_busy_create 3 in
+    Unix.sleepf 0.01;
+    check "no more entries than busy holds"
+      (Xenctrl.pcpu_sample xc s small = 3);
+
+    (* Aggregation, on known values: the fake has 2 threads per core
+       and 8 cores per socket *)
+    check "fake topology"
+      (physinfo.Xenctrl.threads_per_core = 2
+       && physinfo.Xenctrl.cores_per_socket = 8 && nr = 32);
+    for i = 0 to nr - 1 do busy.{i} <- float_of_int i done;
+    check "by_core"
+      (Xenctrl.pcpu_busy_by_core physinfo busy nr
+       = Array.init 16 (fun c -> float_of_int (4 * c + 1) /. 2.));
+    check "by_socket"
+      (Xenctrl.pcpu_busy_by_socket physinfo busy nr = [| 7.5; 23.5 |]);
+    check "a partial core is averaged over its cpus"
+      (Xenctrl.pcpu_busy_by_core physinfo busy 5 = [| 0.5; 2.5; 4. |]))
+
+(* Affinity *)
+
+let cpumap_of xc cpus =
+  let map = Xenctrl.cpumap_create xc in
+  List.iter (Xenctrl.cpumap_set map) cpus;
+  map
+
+let test_cpumap_affinity () =
+  Xenctrl.with_intf (fun xc ->
+    (* The fake has 32 pCPUs, so 4-byte maps, and 4 vcpus per domain *)
+    let map = cpumap_of xc [0; 9; 31] in
+    check "libxc bit layout" (Bytes.to_string map = "\x01\x02\x00\x80");
+    check "cpumap_mem"
+      (List.for_all (Xenctrl.cpumap_mem map) [0; 9; 31]
+       && not (Xenctrl.cpumap_mem map 8));
+    Xenctrl.cpumap_clear map 9;
+    check "cpumap_clear" (Bytes.to_string map = "\x01\x00\x00\x80");
+
+    let domid = Xenctrl.domain_create xc 0l [] uuid in
+    Xenctrl.vcpu_affinity_set_cpumap xc domid 1 map;
+    check "set then get"
+      (Xenctrl.vcpu_affinity_get_cpumap xc domid 1 = map);
+    Xenctrl.vcpu_affinity_set_cpumap xc domid 2 (Bytes.of_string "\x03");
+    check "a short map is padded"
+      (Bytes.to_string (Xenctrl.vcpu_affinity_get_cpumap xc domid 2)
+       = "\x03\x00\x00\x00");
+
+    let bools = Array.init 32 (fun cpu -> cpu mod 3 = 0) in
+    Xenctrl.vcpu_affinity_set xc domid 3 bools;
+    check "bool arrays and cpumaps agree"
+      (Xenctrl.vcpu_affinity_get xc domid 3 = bools
+       && (let m = Xenctrl.vcpu_affinity_get_cpumap xc domid 3 in
+           List.for_all (fun cpu -> Xenctrl.cpumap_mem m cpu = bools.(cpu))
+             (List.init 32 Fun.id)));
+
+    let get_all () =
+      Array.init 4 (fun v -> Xenctrl.vcpu_affinity_get_cpumap xc domid v) in
+    let one = cpumap_of xc [4; 5] in
+    Xenctrl.domain_set_affinity_all_vcpus xc domid [| one |];
+    check "one map for every vcpu"
+      (Array.for_all (( = ) one) (get_all ()));
+    let per_vcpu = Array.init 4 (fun v -> cpumap_of xc [v; 16 + v]) in
+    Xenctrl.domain_set_affinity_all_vcpus xc domid per_vcpu;
+    check "one map per vcpu" (get_all () = per_vcpu);
+    check "neither one map nor one per vcpu"
+      (try
+         Xenctrl.domain_set_affinity_all_vcpus xc domid [| one; one |];
+         false
+       with Invalid_argument _ -> true);
+    check "a missing domain"
+      (try Xenctrl.domain_set_affinity_all_vcpus xc 9999 [| one |]; false
+       with Xenctrl.Error _ -> true);
+    Xenctrl.domain_destroy xc domid)
+
+(* Handle pool *)
+
+let test_handle_pool () =
+  let pool = Xenctrl.handle_pool_create 2 in
+  let a = Xenctrl.handle_pool_checkout pool in
+  let b = Xenctrl.handle_pool_checkout pool in
+  check "checked out handles are distinct" (a <> b);
+  let extra = Xenctrl.handle_pool_checkout pool in
+  check "an unpooled handle past the pool's size" (extra <> a && extra <> b);
+  check "every handle works"
+    (List.for_all (fun xc -> Xenctrl.domain_exists xc 0) [a; b; extra]);
+  Xenctrl.handle_pool_return pool extra;
+  Xenctrl.handle_pool_return pool a;
+  check "a returned handle is handed out again"
+    (Xenctrl.with_pool_intf pool (fun xc -> xc = a));
+  let seen = Hashtbl.create 4 in
+  Hashtbl.replace seen a ();
+  check "handles hash by identity"
+    (Xenctrl.with_pool_intf pool (fun xc -> Hashtbl.mem seen xc));
+  Xenctrl.handle_pool_return pool b
+
+(* Hypercall buffers *)
+
+let test_getinfolist_reuses_buffer () =
+  Xenctrl.with_intf (fun xc ->
+    let n = List.length (Xenctrl.domain_getinfolist xc 0) in
+    let grows = Xenctrl.handle_buffer_grows xc in
+    check "first call sizes the buffer" (grows > 0);
+    for _ = 1 to 10 do
+      check "every domain reported"
+        (List.length (Xenctrl.domain_getinfolist xc 0) = n)
+    done;
+    ignore (Xenctrl.pcpu_info xc 4);
+    check "later calls reuse it" (Xenctrl.handle_buffer_grows xc = grows))
+
+(* Runstate sampler *)
+
+let test_runstate_sample_overflow () =
+  Xenctrl.with_intf (fun xc ->
+    let sampler = Xenctrl.runstate_sampler_create () in
+    let small = Xenctrl.runstate_matrix_create 2 in
+    let n = Xenctrl.runstate_sample xc sampler true small in
+    check "more domains than rows are reported" (n > 2);
+    check "the rows that fit are filled"
+      (Bigarray.Array2.get small 1 Xenctrl.runstate_col_domid = 1L);
+    let big = Xenctrl.runstate_matrix_create n in
+    check "a matrix of the returned size holds every domain"
+      (Xenctrl.runstate_sample xc sampler true big = n))
+
+(* Xenmmap views *)
+
+let map_zero len =
+  let fd = Unix.openfile "/dev/zero" [Unix.O_RDWR] 0 in
+  let intf = Xenmmap.mmap fd Xenmmap.RDWR Xenmmap.PRIVATE len 0 in
+  Unix.close fd;
+  intf
+
+let test_view_outlives_interface () =
+  let view = Xenmmap.to_bigarray (map_zero 4096) in
+  Gc.full_major ();
+  Gc.full_major ();
+  Bigarray.Array1.set view 4095 'x';
+  check "view still mapped" (Bigarray.Array1.get view 4095 = 'x')
+
+let test_unmap_keeps_views () =
+  let intf = map_zero 4096 in
+  let view = Xenmmap.to_bigarray intf in
+  let sub = Bigarray.Array1.sub view 100 10 in
+  Xenmmap.unmap intf;
+  check "interface is unmapped"
+    (try ignore (Xenmmap.read intf 0 1); false
+     with Invalid_argument _ -> true);
+  Bigarray.Array1.set view 100 'y';
+  check "sub-array shares the pages" (Bigarray.Array1.get sub 0 = 'y');
+  Xenmmap.unmap intf
+
+let map_zero_with options len =
+  let fd = Unix.openfile "/dev/zero" [Unix.O_RDWR] 0 in
+  let intf =
+    try Xenmmap.mmap_with_options fd Xenmmap.RDWR Xenmmap.PRIVATE len 0 options
+    with e -> Unix.close fd; raise e in
+  Unix.close fd;
+  intf
+
+let test_mmap_options () =
+  let len = 4 * Xenmmap.getpagesize () in
+  let usable intf =
+    Xenmmap.write intf "abc" (len - 3) 3;
+    let ok = Xenmmap.read intf 0 1 = "\000"
+             && Xenmmap.read intf (len - 3) 3 = "abc" in
+    Xenmmap.unmap intf;
+    ok in
+  List.iter (fun (name, options) ->
+    check name (usable (map_zero_with options len))) [
+    "POPULATE", [Xenmmap.POPULATE];
+    "HUGEPAGE", [Xenmmap.HUGEPAGE];
+    "SEQUENTIAL", [Xenmmap.SEQUENTIAL];
+    "advice combined", [Xenmmap.POPULATE; Xenmmap.HUGEPAGE; Xenmmap.SEQUENTIAL];
+  ];
+  (* Whether mlock succeeds depends on RLIMIT_MEMLOCK; a refusal must
+     name the option *)
+  check "LOCKED"
+    (match map_zero_with [Xenmmap.LOCKED; Xenmmap.POPULATE] len with
+     | intf -> usable intf
+     | exception Failure msg -> contains msg "LOCKED");
+  check "bad length"
+    (try ignore (map_zero_with [Xenmmap.POPULATE] 0); false
+     with Invalid_argument _ -> true)
+
+(* Foreign mappings *)
+
+let is_mapped map =
+  try ignore (Xenmmap.read map 0 1); true
+  with Invalid_argument _ -> false
+
+let test_map_foreign_range_size () =
+  Xenctrl.with_intf (fun xc ->
+    let page = Xenmmap.getpagesize () in
+    List.iter (fun size ->
+      check (Printf.sprintf "size %d rejected" size)
+        (try ignore (Xenctrl.map_foreign_range xc 1 size 1n); false
+         with Invalid_argument _ -> true))
+      ([0; -page; 100; page + 1]
+       @ if Sys.int_size > 32 then [1 lsl 31; 1 lsl 44] else []);
+    let map = Xenctrl.map_foreign_range xc 1 (3 * page) 1n in
+    check "every page mapped"
+      (Bigarray.Array1.dim (Xenmmap.to_bigarray map) = 3 * page);
+    Xenmmap.unmap map)
+
+let frame_at map page i =
+  Bytes.get_int64_ne (Bytes.of_string (Xenmmap.read map (i * page) 8)) 0
+
+let test_map_foreign_bulk () =
+  Xenctrl.with_intf (fun xc ->
+    let page = Xenmmap.getpagesize () in
+    (* The fake's domains own their first 256Ki frames *)
+    let frames = Bigarray.Array1.of_array Bigarray.int64 Bigarray.c_layout
+        [| 7L; 1_000_000L; 3L; 1_000_001L; 5L |] in
+    let errors = Bigarray.Array1.create Bigarray.int32 Bigarray.c_layout 5 in
+    Bigarray.Array1.fill errors 1l;
+    let map = Xenctrl.map_foreign_bulk xc 1 Xenmmap.RDWR frames errors in
+    check "one page per frame"
+      (Bigarray.Array1.dim (Xenmmap.to_bigarray map) = 5 * page);
+    Array.iteri (fun i expected ->
+      check (Printf.sprintf "errors.{%d}" i) (errors.{i} = expected))
+      [| 0l; -22l; 0l; -22l; 0l |];
+    List.iter (fun i ->
+      check (Printf.sprintf "page %d maps its frame" i)
+        (frame_at map page i = frames.{i})) [0; 2; 4];
+    check "a failed frame leaves its page empty" (frame_at map page 1 = 0L);
+    Xenmmap.unmap map;
+    check "unmapped" (not (is_mapped map));
+    Xenmmap.unmap map;
+    check "a missing domain fails the batch"
+      (try
+         ignore (Xenctrl.map_foreign_bulk xc 9999 Xenmmap.RDWR frames errors);
+         false
+       with Failure _ -> true);
+    check "errors must match frames"
+      (try
+         let short = Bigarray.Array1.sub errors 0 4 in
+         ignore (Xenctrl.map_foreign_bulk xc 1 Xenmmap.RDWR frames short);
+         false
+       with Invalid_argument _ -> true))
+
+(* Foreign map cache *)
+
+let test_foreign_map_cache_lru () =
+  Xenctrl.with_intf (fun xc ->
+    let cache = Xenctrl.foreign_map_cache_create 2 in
+    let m1 = Xenctrl.map_foreign_cached cache xc 4 1n in
+    let m2 = Xenctrl.map_foreign_cached cache xc 4 2n in
+    check "hit returns the same mapping"
+      (Xenctrl.map_foreign_cached cache xc 4 1n == m1);
+    ignore (Xenctrl.map_foreign_cached cache xc 4 3n);
+    check "least recently used page evicted" (not (is_mapped m2));
+    check "recently used page kept" (is_mapped m1);
+    let stats = Xenctrl.foreign_map_cache_stats cache in
+    check "stats" (stats.Xenctrl.hits = 1 && stats.Xenctrl.misses = 3
+                   && stats.Xenctrl.evictions = 1 && stats.Xenctrl.mapped = 2))
+
+let test_foreign_map_cache_watcher () =
+  Xenctrl.with_intf (fun xc ->
+    let w = Xenctrl.domain_watcher_create () in
+    let cache = Xenctrl.foreign_map_cache_create ~watcher:w 4 in
+    ignore (Xenctrl.domain_watcher_changes xc w);
+    let m = Xenctrl.map_foreign_cached cache xc 5 1n in
+    Xenctrl.domain_destroy xc 5;
+    ignore (Xenctrl.domain_watcher_changes xc w);
+    check "destroyed domain invalidated" (not (is_mapped m));
+    check "nothing left mapped"
+      ((Xenctrl.foreign_map_cache_stats cache).Xenctrl.mapped = 0);
+    Xenctrl.domain_watcher_close w)
+
+(* NUMA placement *)
+
+(* Four nodes of four pCPUs: 0-1 and 2-3 are near pairs *)
+let numainfo = {
+  Xenctrl.node_memsize = Array.make 4 0x400000000L;
+  node_memfree = [| 0x200000000L; 0x400000000L; 0x100000000L; 0x100000000L |];
+  node_distances = [| [| 10; 12; 20; 20 |];
+                      [| 12; 10; 20; 20 |];
+                      [| 20; 20; 10; 12 |];
+                      [| 20; 20; 12; 10 |] |];
+}
+
+let topo = Array.init 16 (fun cpu ->
+  { Xenctrl.core = cpu mod 4; socket = cpu / 8; node = cpu / 4 })
+
+let gib n = Int64.shift_left (Int64.of_int n) 30
+
+let placed ?node_load ~vcpus ~memory () =
+  Xenctrl.numa_place ?node_load numainfo topo ~vcpus ~memory
+
+let test_numa_place () =
+  let nodes_and_map p =
+    p.Xenctrl.placement_nodes, Bytes.to_string p.Xenctrl.placement_cpumap in
+  check "small VM on the node with most free memory"
+    (match placed ~vcpus:2 ~memory:(gib 4) () with
+     | Some p -> nodes_and_map p = ([1], "\xf0\x00")
+     | None -> false);
+  check "load steers placement off a busy node"
+    (match placed ~node_load:[| 0; 8; 0; 0 |] ~vcpus:2 ~memory:(gib 4) () with
+     | Some p -> nodes_and_map p = ([0], "\x0f\x00")
+     | None -> false);
+  check "large VM spans the nearest pair"
+    (match placed ~vcpus:6 ~memory:(gib 4) () with
+     | Some p -> nodes_and_map p = ([0; 1], "\xff\x00")
+     | None -> false);
+  check "too much memory" (placed ~vcpus:1 ~memory:(gib 64) () = None);
+  check "too many vcpus" (placed ~vcpus:17 ~memory:(gib 1) () = None)
+
+(* Featureset algebra *)
+
+let fs = Xenctrl.featureset_of_array
+let words = Xenctrl.featureset_to_array
+
+let test_featureset_algebra () =
+  let a = fs [| 0xf0f0f0f0L; 0x1L; 0x80000000L |] in
+  let b = fs [| 0xff00ff00L; 0x3L |] in
+  check "packing round-trips unsigned words"
+    (words (fs [| 0xffffffffL; 0L |]) = [| 0xffffffffL; 0L |]);
+  check "inter" (words (Xenctrl.featureset_inter a b)
+                 = [| 0xf000f000L; 0x1L |]);
+  check "union" (words (Xenctrl.featureset_union a b)
+                 = [| 0xfff0fff0L; 0x3L; 0x80000000L |]);
+  check "diff keeps the longer tail"
+    (words (Xenctrl.featureset_diff a b) = [| 0x00f000f0L; 0L; 0x80000000L |]);
+  check "diff" (words (Xenctrl.featureset_diff b a) = [| 0x0f000f00L; 0x2L |]);
+  check "inter is a subset of both"
+    (let i = Xenctrl.featureset_inter a b in
+     Xenctrl.featureset_subset i a && Xenctrl.featureset_subset i b);
+  check "not a subset" (not (Xenctrl.featureset_subset a b));
+  check "zero padding is a subset"
+    (Xenctrl.featureset_subset (fs [| 0L; 0L; 0L; 0L |]) b);
+  check "a feature past the end is not a subset"
+    (not (Xenctrl.featureset_subset (fs [| 0L; 0L; 1L |]) b));
+  check "popcount" (Xenctrl.featureset_popcount a = 18);
+  check "level"
+    (words (Xenctrl.featureset_level [| a; b; fs [| 0xffffffffL; 0L; 0xffL |] |])
+     = [| 0xf000f000L; 0L |]);
+  check "level of no hosts"
+    (try ignore (Xenctrl.featureset_level [||]); false
+     with Invalid_argument _ -> true)
+
+(* Statistics *)
+
+let test_stats_to_prometheus () =
+  let buckets = Array.make 38 0L in
+  buckets.(1) <- 2L;
+  buckets.(37) <- 1L;
+  let text = Xenctrl.Stats.to_prometheus [ {
+    Xenctrl.Stats.name = "domain_pause"; calls = 3L; errors = 1L;
+    total_ns = 1500000000L; buckets } ] in
+  List.iter (fun line -> check line (contains text (line ^ "\n"))) [
+    "# TYPE xenctrl_call_seconds histogram";
+    "xenctrl_call_seconds_bucket{op=\"domain_pause\",le=\"1e-09\"} 0";
+    "xenctrl_call_seconds_bucket{op=\"domain_pause\",le=\"2e-09\"} 2";
+    "xenctrl_call_seconds_bucket{op=\"domain_pause\",le=\"68.7195\"} 2";
+    "xenctrl_call_seconds_bucket{op=\"domain_pause\",le=\"+Inf\"} 3";
+    "xenctrl_call_seconds_sum{op=\"domain_pause\"} 1.5";
+    "xenctrl_call_seconds_count{op=\"domain_pause\"} 3";
+    "# TYPE xenctrl_call_errors_total counter";
+    "xenctrl_call_errors_total{op=\"domain_pause\"} 1";
+  ]
+
+let stats_of name =
+  try List.find (fun op -> op.Xenctrl.Stats.name = name)
+        (Xenctrl.Stats.snapshot ())
+  with Not_found -> failwith ("no stats for " ^ name)
+
+let test_stats_ops () =
+  Xenctrl.with_intf (fun xc ->
+    Xenctrl.Stats.set_enabled true;
+    Xenctrl.Stats.reset ();
+    Xenctrl.domain_unpause xc 1;
+    (try Xenctrl.domain_pause xc 9999 with Xenctrl.Error _ -> ());
+    ignore (Xenctrl.physinfo xc);
+    (try ignore (Xenctrl.map_foreign_range xc 9999 4096 1n)
+     with Failure _ -> ());
+    Xenctrl.Stats.set_enabled false;
+    let calls_errors name =
+      let op = stats_of name in
+      op.Xenctrl.Stats.calls, op.Xenctrl.Stats.errors in
+    check "ops named after their function"
+      (calls_errors "domain_unpause" = (1L, 0L));
+    check "Error charged to its own op"
+      (calls_errors "domain_pause" = (1L, 1L));
+    check "nothing charged to the previous call"
+      (calls_errors "physinfo" = (1L, 0L));
+    check "Failure counted"
+      (calls_errors "map_foreign_range" = (1L, 1L));
+    check "sethandle has an op of its own"
+      (Xenctrl.Stats.set_enabled true;
+       Xenctrl.domain_sethandle xc 1 "00000000-0000-0000-0000-000000000001";
+       Xenctrl.Stats.set_enabled false;
+       calls_errors "domain_sethandle" = (1L, 0L));
+    check "nothing unnamed"
+      (not (List.exists (fun op -> op.Xenctrl.Stats.name = "unknown")
+              (Xenctrl.Stats.snapshot ()))))
+
+(* Exception-free queries *)
+
+let esrch = { Xenctrl.errno = 3; xc_code = 0 }
+
+let test_result_queries () =
+  Xenctrl.with_intf (fun xc ->
+    (* A destroyed domain followed by live ones: a query for it must not
+       return the next domain *)
+    let gone = Xenctrl.domain_create xc 0l [] uuid in
+    let next = Xenctrl.domain_create xc 0l [] uuid in
+    Xenctrl.domain_destroy xc gone;
+
+    check "domain 0 exists" (Xenctrl.domain_exists xc 0);
+    check "a missing domain does not" (not (Xenctrl.domain_exists xc 9999));
+    check "a destroyed domain does not" (not (Xenctrl.domain_exists xc gone));
+
+    check "getinfo_result of a domain"
+      (match Xenctrl.domain_getinfo_result xc 1 with
+       | Ok i -> i.Xenctrl.domid = 1
+       | Error _ -> false);
+    check "getinfo_result of a missing domain"
+      (Xenctrl.domain_getinfo_result xc 9999 = Error esrch);
+    check "getinfo_result of a destroyed domain"
+      (Xenctrl.domain_getinfo_result xc gone = Error esrch);
+
+    check "getinfolist_result"
+      (match Xenctrl.domain_getinfolist_result xc 0 with
+       | Ok a -> Array.length a = List.length (Xenctrl.domain_getinfolist xc 0)
+       | Error _ -> false);
+    check "getinfolist_result past the last domain"
+      (Xenctrl.domain_getinfolist_result xc 100000 = Ok [||]);
+
+    check "vcpuinfo_result of a vcpu"
+      (match Xenctrl.domain_get_vcpuinfo_result xc 1 0 with
+       | Ok v -> v.Xenctrl.online
+       | Error _ -> false);
+    check "vcpuinfo_result of a missing domain"
+      (Xenctrl.domain_get_vcpuinfo_result xc 9999 0 = Error esrch);
+    check "vcpuinfo_result of a missing vcpu"
+      (match Xenctrl.domain_get_vcpuinfo_result xc 1 999 with
+       | Error e -> e.Xenctrl.errno = 22
+       | Ok _ -> false);
+
+    check "call_error_message"
+      (contains (Xenctrl.call_error_message esrch) "3: ");
+    check "raise_call_error"
+      (try Xenctrl.raise_call_error esrch
+       with Xenctrl.Error msg -> msg = Xenctrl.call_error_message esrch);
+
+    Xenctrl.Stats.set_enabled true;
+    Xenctrl.Stats.reset ();
+    ignore (Xenctrl.domain_getinfo_result xc 9999);
+    ignore (Xenctrl.domain_getinfo_result xc 1);
+    Xenctrl.Stats.set_enabled false;
+    let op = stats_of "domain_getinfo_result" in
+    check "errors returned are counted"
+      (op.Xenctrl.Stats.calls = 2L && op.Xenctrl.Stats.errors = 1L);
+    Xenctrl.domain_destroy xc next)
+
+(* Uuids *)
+
+let invalid f x = try ignore (f x); false with Invalid_argument _ -> true
+
+let test_uuid_codec () =
+  let s = "0123abcd-4567-89ef-0a1b-456789ABCDEF" in
+  let u = Xenctrl.uuid_of_string s in
+  check "to_string is lower case"
+    (Xenctrl.uuid_to_string u = "0123abcd-4567-89ef-0a1b-456789abcdef");
+  check "raw bytes"
+    (Xenctrl.uuid_to_bytes u
+     = "\x01\x23\xab\xcd\x45\x67\x89\xef\x0a\x1b\x45\x67\x89\xab\xcd\xef");
+  check "bytes round-trip"
+    (Xenctrl.uuid_of_bytes (Xenctrl.uuid_to_bytes u) = u);
+  check "handle round-trip"
+    (Xenctrl.uuid_of_handle (Xenctrl.handle_of_uuid u) = u);
+  List.iter (fun bad ->
+    check ("rejects " ^ String.escaped bad)
+      (invalid Xenctrl.uuid_of_string bad)) [
+    "";
+    "0123abcd-4567-89ef-0a1b-456789abcde";
+    "0123abcd-4567-89ef-0a1b-456789abcdef0";
+    "0123abcd04567-89ef-0a1b-456789abcdef";
+    "0123abc-d4567-89ef-0a1b-456789abcdef";
+    "0123abcd-4567-89ef-0a1b-456789abcdeg";
+    "0123abcd-4567-89ef-0a1b-456789abcde\000";
+    "0123abcd-4567-89ef-0a1b-456789abcd\xcf\x80";
+    "{123abcd-4567-89ef-0a1b-456789abcdef";
+  ];
+  check "uuid_of_bytes checks the length"
+    (invalid Xenctrl.uuid_of_bytes (String.make 15 'x'));
+  check "uuid_of_handle checks the length"
+    (invalid Xenctrl.uuid_of_handle (Array.make 17 0))
+
+let domaininfo domid uuid = {
+  Xenctrl.domid; dying = false; shutdown = false; paused = false;
+  blocked = false; running = true; hvm_guest = false; shutdown_code = 0;
+  total_memory_pages = 0n; max_memory_pages = 0n; shared_info_frame = 0L;
+  cpu_time = 0L; nr_online_vcpus = 1; max_vcpu_id = 0; ssidref = 0l;
+  handle = Xenctrl.handle_of_uuid (Xenctrl.uuid_of_string uuid);
+}
+
+let test_uuid_index () =
+  let u1 = "00000000-0000-0000-0000-000000000001"
+  and u2 = "00000000-0000-0000-0000-000000000002"
+  and u3 = "00000000-0000-0000-0000-000000000003"
+  and u4 = "00000000-0000-0000-0000-000000000004" in
+  let uuid = Xenctrl.uuid_of_string in
+  let idx = Xenctrl.uuid_index_create () in
+  Xenctrl.uuid_index_update idx [| domaininfo 1 u1; domaininfo 2 u2 |];
+  check "update adds" (Xenctrl.uuid_index_length idx = 2
+                       && Xenctrl.uuid_index_find idx (uuid u1) = Some 1
+                       && Xenctrl.uuid_index_uuid idx 2 = Some (uuid u2));
+  Xenctrl.uuid_index_update idx [| domaininfo 1 u1; domaininfo 2 u3 |];
+  check "update follows a new handle"
+    (Xenctrl.uuid_index_find idx (uuid u2) = None
+     && Xenctrl.uuid_index_find idx (uuid u3) = Some 2);
+  Xenctrl.uuid_index_update idx [| domaininfo 1 u1 |];
+  check "update drops missing domains"
+    (Xenctrl.uuid_index_length idx = 1
+     && Xenctrl.uuid_index_uuid idx 2 = None
+     && Xenctrl.uuid_index_find idx (uuid u3) = None);
+  Xenctrl.uuid_index_apply_changes idx [
+    Xenctrl.Domain_created (domaininfo 3 u2);
+    Xenctrl.Domain_destroyed 1;
+    Xenctrl.Domain_changed (domaininfo 3 u4);
+  ];
+  check "changes applied in order"
+    (Xenctrl.uuid_index_length idx = 1
+     && Xenctrl.uuid_index_find idx (uuid u1) = None
+     && Xenctrl.uuid_index_find idx (uuid u2) = None
+     && Xenctrl.uuid_index_find idx (uuid u4) = Some 3)
+
+let tests = [
+  "to_bigarray view outlives its interface", false, test_view_outlives_interface;
+  "unmap keeps views mapped", false, test_unmap_keeps_views;
+  "mmap_with_options", false, test_mmap_options;
+  "domain_watcher virq", true, test_domain_watcher_virq;
+  "domain_watcher polling fallback", true, test_domain_watcher_fallback;
+  "all_vcpuinfo of a missing domain", true, test_all_vcpuinfo_missing_domain;
+  "domain_create_full rolls back", true, test_domain_create_full_rollback;
+  "domain_destroy_many with workers", true, test_domain_destroy_many;
+  "runstate_sample into a small matrix", true, test_runstate_sample_overflow;
+  "getinfolist reuses the handle's buffer", true, test_getinfolist_reuses_buffer;
+  "console_reader", true, test_console_reader;
+  "pcpu_sampler and aggregation", true, test_pcpu_sampler;
+  "map_foreign_range size checks", true, test_map_foreign_range_size;
+  "map_foreign_bulk and unmap", true, test_map_foreign_bulk;
+  "foreign_map_cache LRU eviction", true, test_foreign_map_cache_lru;
+  "foreign_map_cache follows a watcher", true, test_foreign_map_cache_watcher;
+  "numa_place on a synthetic topology", false, test_numa_place;
+  "featureset algebra", false, test_featureset_algebra;
+  "Stats.to_prometheus", false, test_stats_to_prometheus;
+  "uuid codec", false, test_uuid_codec;
+  "uuid_index", false, test_uuid_index;
+  "Stats ops and errors", true, test_stats_ops;
+  "result queries and domain_exists", true, test_result_queries;
+  "cpumap layout and affinity round trip", true, test_cpumap_affinity;
+  "handle_pool checkout and return", true, test_handle_pool;
+]
+
+let () =
+  List.iter run tests;
+  exit (if !failures = 0 then 0 else 1)